@@ -22,6 +22,12 @@
 
 #include "abnf.h"
 #include <time.h>
+#include <stdarg.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+volatile sig_atomic_t abnf_stop_flag = 0;
 
 struct abnf_rule* abnf_find_rule(struct abnf_rule* rules, struct abnf_str name) {
 	for (; rules; rules=rules->next) {
@@ -70,6 +76,390 @@ void abnf_destroy_str(struct abnf_str *s) {
 	s->flags = 0;
 }
 
+/* region allocator */
+#define ABNF_POOL_HDR_SIZE ((sizeof(struct abnf_pool_block)+ABNF_POOL_ALIGN-1) & ~(ABNF_POOL_ALIGN-1))
+
+void abnf_init_pool(struct abnf_pool *pool) {
+	abnf_init_pool_ctx(pool, NULL);
+}
+
+void abnf_init_pool_ctx(struct abnf_pool *pool, struct abnf_context *ctx) {
+	pool->block = NULL;
+	pool->ctx = ctx;
+}
+
+static void* abnf_pool_get(struct abnf_pool *pool, size_t size, size_t align) {
+	struct abnf_pool_block *b;
+	size_t ofs;
+	b = pool->block;
+	if (b) {
+		ofs = (b->used + align-1) & ~(align-1);
+		if (ofs + size <= b->size) {
+			b->used = ofs + size;
+			return (char*) b + ABNF_POOL_HDR_SIZE + ofs;
+		}
+	}
+	if (size > ABNF_POOL_BLOCK_SIZE/4) {
+		/* big item gets own block, current block keeps its free space */
+		b = abnf_ctx_alloc(pool->ctx, ABNF_POOL_HDR_SIZE + size);
+		if (!b) return NULL;
+		b->size = b->used = size;
+		if (pool->block) {
+			b->next = pool->block->next;
+			pool->block->next = b;
+		}
+		else {
+			b->next = NULL;
+			pool->block = b;
+		}
+		return (char*) b + ABNF_POOL_HDR_SIZE;
+	}
+	b = abnf_ctx_alloc(pool->ctx, ABNF_POOL_HDR_SIZE + ABNF_POOL_BLOCK_SIZE);
+	if (!b) return NULL;
+	b->size = ABNF_POOL_BLOCK_SIZE;
+	b->used = size;
+	b->next = pool->block;
+	pool->block = b;
+	return (char*) b + ABNF_POOL_HDR_SIZE;
+}
+
+void* abnf_pool_alloc(struct abnf_pool *pool, size_t size) {
+	if (!pool) return abnf_malloc(size);
+	return abnf_pool_get(pool, size, ABNF_POOL_ALIGN);
+}
+
+struct abnf_str abnf_pool_dupl_str(struct abnf_pool *pool, struct abnf_str s) {
+	struct abnf_str as;
+	if (!pool) return abnf_dupl_str(s);
+	as.flags = 0;  /* released with pool */
+	as.len = 0;
+	as.s = NULL;
+	if (s.len > 0) {
+		as.s = abnf_pool_get(pool, s.len, 1);
+		if (as.s) {
+			memcpy(as.s, s.s, s.len);
+			as.len = s.len;
+		}
+	}
+	return as;
+}
+
+void abnf_destroy_pool(struct abnf_pool *pool) {
+	struct abnf_pool_block *b;
+	while (pool->block) {
+		b = pool->block;
+		pool->block = b->next;
+		abnf_ctx_release(pool->ctx, b);
+	}
+}
+
+void abnf_pool_adopt(struct abnf_pool *dst, struct abnf_pool *src) {
+	struct abnf_pool_block *b;
+	if (!src->block) return;
+	if (!dst->block) {
+		dst->block = src->block;
+	}
+	else {
+		/* dst keeps allocating from its current block */
+		for (b = src->block; b->next; b = b->next);
+		b->next = dst->block->next;
+		dst->block->next = src->block;
+	}
+	src->block = NULL;
+}
+
+void abnf_init_grammar(struct abnf_grammar *g) {
+	abnf_init_grammar_ctx(g, NULL);
+}
+
+void abnf_init_grammar_ctx(struct abnf_grammar *g, struct abnf_context *ctx) {
+	g->ctx = ctx;
+	g->rules = NULL;
+	g->last_rule = NULL;
+	abnf_init_pool_ctx(&g->pool, ctx);
+	g->flags = 0;
+	g->buffers = NULL;
+	g->index = NULL;
+	g->index_size = g->index_count = 0;
+}
+
+#define ABNF_BUFF_CHUNK 1024
+
+int abnf_map_stream(FILE *in_stream, struct abnf_buffer *pb) {
+	struct stat st;
+	char *p;
+
+	pb->s = NULL;
+	pb->len = 0;
+	pb->mapped = 0;
+	pb->next = NULL;
+	/* regular file is mapped, pipes and terminals are not */
+	if (fstat(fileno(in_stream), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && ftell(in_stream) == 0) {
+		p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(in_stream), 0);
+		if (p != MAP_FAILED) {
+			pb->s = p;
+			pb->len = st.st_size;
+			pb->mapped = 1;
+#ifdef MADV_SEQUENTIAL
+			madvise(pb->s, pb->len, MADV_SEQUENTIAL);
+#endif
+		}
+	}
+	return 0;
+}
+
+int abnf_read_stream(FILE *in_stream, struct abnf_buffer *pb) {
+	char *p;
+	size_t i;
+
+	abnf_map_stream(in_stream, pb);
+	if (pb->mapped) return 0;
+	/* read file into buffer */
+	do {
+		p = abnf_realloc(pb->s, pb->len + ABNF_BUFF_CHUNK);
+		if (!p) {
+			if (pb->s) abnf_free(pb->s);
+			pb->s = NULL;
+			return -1;
+		}
+		pb->s = p;
+		i = fread(pb->s+pb->len, sizeof(*pb->s), ABNF_BUFF_CHUNK, in_stream);
+		pb->len += i;
+	} while (i == ABNF_BUFF_CHUNK);
+	return 0;
+}
+
+void abnf_release_buffer(struct abnf_buffer *pb) {
+	if (!pb->s) return;
+	if (pb->mapped)
+		munmap(pb->s, pb->len);
+	else
+		abnf_free(pb->s);
+	pb->s = NULL;
+}
+
+int abnf_grammar_keep_buffer(struct abnf_grammar *g, char *s, size_t len, int mapped) {
+	struct abnf_buffer *pb;
+	pb = abnf_pool_alloc(&g->pool, sizeof(*pb));
+	if (!pb) return -1;
+	pb->s = s;
+	pb->len = len;
+	pb->mapped = mapped;
+	pb->next = g->buffers;
+	g->buffers = pb;
+	return 0;
+}
+
+void abnf_destroy_grammar(struct abnf_grammar *g) {
+	struct abnf_buffer *pb;
+	for (pb = g->buffers; pb; pb = pb->next) {
+		abnf_release_buffer(pb);
+	}
+	g->buffers = NULL;
+	if (g->index) abnf_ctx_release(g->ctx, g->index);
+	g->index = NULL;
+	g->index_size = g->index_count = 0;
+	abnf_destroy_pool(&g->pool);
+	g->rules = NULL;
+	g->last_rule = NULL;
+}
+
+#define ABNF_INDEX_INIT_SIZE 256
+#define ABNF_LOWER(_c_) ( ((_c_)>='A' && (_c_)<='Z')?(_c_)+('a'-'A'):(_c_) )
+
+unsigned int abnf_hash_name(struct abnf_str name) {
+	unsigned int i, h;
+	/* FNV-1a of case folded name */
+	for (i=0, h=2166136261U; i<name.len; i++) {
+		h ^= (unsigned char) ABNF_LOWER(name.s[i]);
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static void abnf_grammar_rehash(struct abnf_grammar *g, unsigned int size) {
+	struct abnf_rule **index, *pr, *next, **pp;
+	unsigned int i;
+	index = abnf_ctx_alloc(g->ctx, sizeof(*index)*size);
+	if (!index) return;  /* longer chains but still working */
+	memset(index, 0, sizeof(*index)*size);
+	for (i=0; i<g->index_size; i++) {
+		for (pr = g->index[i]; pr; pr = next) {
+			next = pr->internal.hash_next;
+			/* keep order of equal names */
+			for (pp = &index[pr->internal.hash & (size-1)]; *pp; pp = &(*pp)->internal.hash_next);
+			*pp = pr;
+			pr->internal.hash_next = NULL;
+		}
+	}
+	if (g->index) abnf_ctx_release(g->ctx, g->index);
+	g->index = index;
+	g->index_size = size;
+}
+
+int abnf_grammar_index_rule(struct abnf_grammar *g, struct abnf_rule *pr) {
+	struct abnf_rule **pp;
+	if (g->index_count >= g->index_size) {
+		abnf_grammar_rehash(g, g->index_size?g->index_size*2:ABNF_INDEX_INIT_SIZE);
+		if (!g->index) return -1;
+	}
+	pr->internal.hash = abnf_hash_name(pr->name);
+	pr->internal.hash_next = NULL;
+	/* append to bucket so first rule in list order is found */
+	for (pp = &g->index[pr->internal.hash & (g->index_size-1)]; *pp; pp = &(*pp)->internal.hash_next);
+	*pp = pr;
+	g->index_count++;
+	return 0;
+}
+
+void abnf_grammar_unindex_rule(struct abnf_grammar *g, struct abnf_rule *pr) {
+	struct abnf_rule **pp;
+	if (!g->index) return;
+	for (pp = &g->index[pr->internal.hash & (g->index_size-1)]; *pp; pp = &(*pp)->internal.hash_next) {
+		if (*pp == pr) {
+			*pp = pr->internal.hash_next;
+			pr->internal.hash_next = NULL;
+			g->index_count--;
+			return;
+		}
+	}
+}
+
+void abnf_grammar_remove_rule(struct abnf_grammar *g, struct abnf_rule *pr) {
+	abnf_grammar_unindex_rule(g, pr);
+	if (g->last_rule == pr) {
+		g->last_rule = pr->prev;
+	}
+	abnf_remove_list_item(g->rules, pr);
+}
+
+struct abnf_rule* abnf_grammar_last_rule(struct abnf_grammar *g) {
+	struct abnf_rule *pr;
+	pr = g->last_rule ? g->last_rule : g->rules;
+	if (pr) {
+		for (; pr->next; pr = pr->next);
+	}
+	g->last_rule = pr;
+	return pr;
+}
+
+struct abnf_alternation* abnf_rule_last_alternation(struct abnf_rule *pr) {
+	struct abnf_alternation *pa;
+	pa = pr->internal.last_alternation ? pr->internal.last_alternation : pr->alternation;
+	if (pa) {
+		for (; pa->next; pa = pa->next);
+	}
+	pr->internal.last_alternation = pa;
+	return pa;
+}
+
+void abnf_rule_append_alternations(struct abnf_rule *pr, struct abnf_alternation *pa) {
+	struct abnf_alternation *last;
+	if (!pa) return;
+	last = abnf_rule_last_alternation(pr);
+	if (last) {
+		last->next = pa;
+		pa->prev = last;
+	}
+	else {
+		pr->alternation = pa;
+	}
+}
+
+struct abnf_rule* abnf_grammar_find_rule(struct abnf_grammar *g, struct abnf_str name) {
+	struct abnf_rule *pr;
+	unsigned int h;
+	if (!g->index) return NULL;
+	h = abnf_hash_name(name);
+	for (pr = g->index[h & (g->index_size-1)]; pr; pr = pr->internal.hash_next) {
+		if (pr->internal.hash == h && pr->name.len == name.len && strncasecmp(pr->name.s, name.s, name.len) == 0) {
+			return pr;
+		}
+	}
+	return NULL;
+}
+
+int abnf_grammar_merge(struct abnf_grammar *g, struct abnf_grammar *src) {
+	FILE *stream = abnf_ctx_diag(g->ctx);
+	struct abnf_rule *pr, *pr2, *next;
+	struct abnf_buffer *pb;
+	int ret = 0;
+
+	/* blocks and index are released by allocator of g */
+	if ((g->ctx?g->ctx->release:NULL) != (src->ctx?src->ctx->release:NULL)) {
+		fprintf(stream, "ERROR: merged grammars use different allocators\n");
+		return -1;
+	}
+	abnf_pool_adopt(&g->pool, &src->pool);
+	if (src->buffers) {
+		for (pb = src->buffers; pb->next; pb = pb->next);
+		pb->next = g->buffers;
+		g->buffers = src->buffers;
+		src->buffers = NULL;
+	}
+	if (!g->rules) {
+		/* nothing to override or extend, take rules with index */
+		if (g->index) abnf_ctx_release(g->ctx, g->index);
+		g->rules = src->rules;
+		g->last_rule = src->last_rule;
+		g->index = src->index;
+		g->index_size = src->index_size;
+		g->index_count = src->index_count;
+		src->rules = NULL;
+		src->last_rule = NULL;
+		src->index = NULL;
+		src->index_size = src->index_count = 0;
+		return 0;
+	}
+	for (pr = src->rules; pr; pr = next) {
+		next = pr->next;
+		pr->prev = pr->next = NULL;
+		pr2 = abnf_grammar_find_rule(g, pr->name);
+		if (pr2) {
+			if (pr->internal.flags & ABNF_INTERNAL_INCREMENTAL) {  /* "=/" */
+				abnf_rule_append_alternations(pr2, pr->alternation);
+				if (pr->internal.last_alternation)
+					pr2->internal.last_alternation = pr->internal.last_alternation;
+				continue;
+			}
+			/* "=" */
+			fprintf(stream, "WARNING: overwriting rule '%.*s', comming from '%.*s' by '%.*s'\n",
+				pr->name.len, pr->name.s,
+				pr2->origin.len, pr2->origin.s,
+				pr->origin.len, pr->origin.s);
+			abnf_grammar_remove_rule(g, pr2);
+		}
+		if (abnf_grammar_append_rules(g, pr) < 0)
+			ret = -1;
+	}
+	src->rules = NULL;
+	src->last_rule = NULL;
+	if (src->index) abnf_ctx_release(src->ctx, src->index);
+	src->index = NULL;
+	src->index_size = src->index_count = 0;
+	return ret;
+}
+
+int abnf_grammar_append_rules(struct abnf_grammar *g, struct abnf_rule *rules) {
+	struct abnf_rule *last_rule;
+	int ret = 0;
+	if (!rules) return 0;
+	last_rule = abnf_grammar_last_rule(g);
+	if (!last_rule) {
+		g->rules = rules;
+	}
+	else {
+		last_rule->next = rules;
+		rules->prev = last_rule;
+	}
+	for (; rules; rules = rules->next) {
+		if (abnf_grammar_index_rule(g, rules) < 0)
+			ret = -1;
+		g->last_rule = rules;
+	}
+	return ret;
+}
+
 int abnf_rule_count(struct abnf_rule *p) {
 	int n;
 	for (n=0; p; p=p->next, n++);
@@ -102,30 +492,32 @@ int abnf_concatenation_count(struct abnf_concatenation *p) {
 		(_p_)->prev = NULL; \
 }
 
-struct abnf_rule* abnf_add_rule(struct abnf_str name, struct abnf_alternation* alternation, struct abnf_rule* next) {
+struct abnf_rule* abnf_add_rule(struct abnf_pool *pool, struct abnf_str name, struct abnf_alternation* alternation, struct abnf_rule* next) {
 	struct abnf_rule* p;
-	p = abnf_malloc(sizeof(*p));
+	p = abnf_pool_alloc(pool, sizeof(*p));
 	if (!p) return next;
 	p->name = name;
 	p->origin.len = 0;
 	p->origin.s = 0;
 	p->alternation = alternation;
+	p->internal.flags = 0;
+	p->internal.last_alternation = NULL;
 	ABNF_ADD_LIST_ITEM(p, next);
 	return p;
 }
 
-struct abnf_alternation* abnf_add_alternation(struct abnf_concatenation *concatenation, struct abnf_alternation *next) {
+struct abnf_alternation* abnf_add_alternation(struct abnf_pool *pool, struct abnf_concatenation *concatenation, struct abnf_alternation *next) {
 	struct abnf_alternation* p;
-	p = abnf_malloc(sizeof(*p));
+	p = abnf_pool_alloc(pool, sizeof(*p));
 	if (!p) return next;
 	p->concatenation = concatenation;
 	ABNF_ADD_LIST_ITEM(p, next);
 	return p;
 }
 
-struct abnf_concatenation* abnf_add_concatenation(struct abnf_repetition repetition, struct abnf_concatenation *next) {
+struct abnf_concatenation* abnf_add_concatenation(struct abnf_pool *pool, struct abnf_repetition repetition, struct abnf_concatenation *next) {
 	struct abnf_concatenation* p;
-	p = abnf_malloc(sizeof(*p));
+	p = abnf_pool_alloc(pool, sizeof(*p));
 	if (!p) return next;
 	p->repetition = repetition;
 	ABNF_ADD_LIST_ITEM(p, next);
@@ -249,9 +641,9 @@ void abnf_destroy_element(struct abnf_element* e) {
 	e->type = ABNF_ET_NONE;
 }
 
-static int abnf_check_element(FILE *stream, struct abnf_rule *rules, struct abnf_rule *pr, struct abnf_element* e);
+static int abnf_check_element(FILE *stream, struct abnf_grammar *g, struct abnf_rule *pr, struct abnf_element* e);
 
-static int abnf_check_alternations(FILE *stream, struct abnf_rule *rules, struct abnf_rule *pr, struct abnf_alternation *pa) {
+static int abnf_check_alternations(FILE *stream, struct abnf_grammar *g, struct abnf_rule *pr, struct abnf_alternation *pa) {
 	int ret = 0;
 	struct abnf_concatenation* pc;
 	for (; pa; pa = pa->next) {
@@ -269,14 +661,14 @@ static int abnf_check_alternations(FILE *stream, struct abnf_rule *rules, struct
 				fprintf(stream, "rule '%.*s': bad repetition '%u' > '%u'\n", pr->name.len, pr->name.s, pc->repetition.min, pc->repetition.max);
 				ret = -1;
 			}
-			if (abnf_check_element(stream, rules, pr, &pc->repetition.element) < 0)
+			if (abnf_check_element(stream, g, pr, &pc->repetition.element) < 0)
 				ret = -1;
 		}
 	}
 	return ret;
 }
 
-static int abnf_check_element(FILE *stream, struct abnf_rule *rules, struct abnf_rule *pr, struct abnf_element* e) {
+static int abnf_check_element(FILE *stream, struct abnf_grammar *g, struct abnf_rule *pr, struct abnf_element* e) {
 	switch (e->type) {
 		case ABNF_ET_NONE:
 			fprintf(stream, "rule '%.*s': element type is NONE\n", pr->name.len, pr->name.s);
@@ -286,7 +678,7 @@ static int abnf_check_element(FILE *stream, struct abnf_rule *rules, struct abnf
 				fprintf(stream, "rule '%.*s': rule name is empty\n", pr->name.len, pr->name.s);
 				return -1;
 			}
-			e->u.rule.resolved = abnf_find_rule(rules, e->u.rule.name);
+			e->u.rule.resolved = abnf_grammar_find_rule(g, e->u.rule.name);
 			if (!e->u.rule.resolved) {
 				fprintf(stream, "rule '%.*s': rule '%.*s' not found\n", pr->name.len, pr->name.s, e->u.rule.name.len, e->u.rule.name.s);
 				return -1;
@@ -297,7 +689,7 @@ static int abnf_check_element(FILE *stream, struct abnf_rule *rules, struct abnf
 				fprintf(stream, "rule '%.*s': group is empty\n", pr->name.len, pr->name.s);
 				return -1;
 			}
-			return abnf_check_alternations(stream, rules, pr, e->u.group);
+			return abnf_check_alternations(stream, g, pr, e->u.group);
 		case ABNF_ET_TOKEN:
 			if (e->u.string.len == 0) {
 				fprintf(stream, "rule '%.*s': token is empty\n", pr->name.len, pr->name.s);
@@ -322,10 +714,11 @@ static int abnf_check_element(FILE *stream, struct abnf_rule *rules, struct abnf
 	return 0;
 }
 
-int abnf_check_rules(FILE *stream, struct abnf_rule *rules) {
+int abnf_check_rules(struct abnf_grammar *g) {
+	FILE *stream = abnf_ctx_diag(g->ctx);
 	struct abnf_rule *pr;
 	int ret = 0, i;
-	for (pr = rules; pr; pr = pr->next) {
+	for (pr = g->rules; pr; pr = pr->next) {
 		if (!pr->alternation) {
 			fprintf(stream, "rule '%.*s': alternation is empty\n", pr->name.len, pr->name.s);
 			ret = -1;
@@ -344,13 +737,13 @@ int abnf_check_rules(FILE *stream, struct abnf_rule *rules) {
 			ret = -1;
 			goto cont;
 		}
-		if (abnf_find_rule(rules, pr->name) != pr) {
+		if (abnf_grammar_find_rule(g, pr->name) != pr) {
 			fprintf(stream, "rule '%.*s': duplicate name\n", pr->name.len, pr->name.s);
 			ret = -1;
 			continue;
 		}
 
-		if (abnf_check_alternations(stream, rules, pr, pr->alternation) < 0)
+		if (abnf_check_alternations(stream, g, pr, pr->alternation) < 0)
 			ret = -1;
 	cont: ;
 	}
@@ -359,106 +752,229 @@ int abnf_check_rules(FILE *stream, struct abnf_rule *rules) {
 
 #define ABNF_INTERNAL_CIRCULAR 0x01
 #define ABNF_INTERNAL_RESOLVED 0x02
+#define ABNF_INTERNAL_VISITED  0x04
+#define ABNF_INTERNAL_ONSTACK  0x08
 
-static int abnf_resolve_rule2_dependencies(FILE *stream, struct abnf_rule *pr, struct abnf_rule **pr_arr, unsigned int *n);
+/* Tarjan's strongly connected components, components are completed in dependency order */
+struct abnf_scc_state {
+	FILE *stream;
+	struct abnf_rule **stack;
+	unsigned int sp;
+	unsigned int counter, order;
+	struct abnf_rule **pr_arr;  /* resolved rules */
+	unsigned int n;
+	unsigned int groups;
+};
 
-static int abnf_resolve_rule_alternation_dependencies(FILE *stream, struct abnf_rule *pr, struct abnf_alternation *pa, struct abnf_rule **pr_arr, unsigned int *n) {
+static void abnf_scc_visit(struct abnf_scc_state *st, struct abnf_rule *pr);
+
+static void abnf_scc_alternations(struct abnf_scc_state *st, struct abnf_rule *pr, struct abnf_alternation *pa, int *self_ref) {
 	struct abnf_concatenation *pc;
-	int ret = 0;
+	struct abnf_rule *pr2;
 	for (; pa; pa = pa->next) {
 		for (pc = pa->concatenation; pc; pc = pc->next) {
 			switch (pc->repetition.element.type) {
 				case ABNF_ET_RULE:
-					if (pc->repetition.element.u.rule.resolved &&
-						pc->repetition.element.u.rule.resolved != pr &&
-						(pc->repetition.element.u.rule.resolved->internal.flags & ABNF_INTERNAL_RESOLVED) == 0
-						) {
-						if (pc->repetition.element.u.rule.resolved->internal.flags & ABNF_INTERNAL_CIRCULAR) {
-							fprintf(stream, "rule '%.*s' has circular dependency with '%.*s'\n", pr->name.len, pr->name.s, pc->repetition.element.u.rule.resolved->name.len, pc->repetition.element.u.rule.resolved->name.s);
-							ret = -1;
-							break;
-						}
-						if (abnf_resolve_rule2_dependencies(stream, pc->repetition.element.u.rule.resolved, pr_arr, n) < 0) {
-							ret = -1;
-						}
+					pr2 = pc->repetition.element.u.rule.resolved;
+					if (!pr2) break;
+					if (pr2 == pr) {
+						*self_ref = 1;
+					}
+					else if ((pr2->internal.flags & ABNF_INTERNAL_VISITED) == 0) {
+						abnf_scc_visit(st, pr2);
+						if (pr2->internal.lowlink < pr->internal.lowlink)
+							pr->internal.lowlink = pr2->internal.lowlink;
+					}
+					else if (pr2->internal.flags & ABNF_INTERNAL_ONSTACK) {
+						if (pr2->internal.index < pr->internal.lowlink)
+							pr->internal.lowlink = pr2->internal.index;
 					}
 					break;
-
 				case ABNF_ET_GROUP:
-					if (abnf_resolve_rule_alternation_dependencies(stream, pr, pc->repetition.element.u.group, pr_arr, n) < 0) {
-						ret = -1;
-					}
+					abnf_scc_alternations(st, pr, pc->repetition.element.u.group, self_ref);
 					break;
 				default:
 					;
 			}
 		}
 	}
-	return ret;
 }
 
-static int abnf_resolve_rule2_dependencies(FILE *stream, struct abnf_rule *pr, struct abnf_rule **pr_arr, unsigned int *n) {
-	int ret;
-	/* if (pr->internal.flags & ABNF_INTERNAL_RESOLVED) return 0; tested before invocation */
-	pr->internal.flags |= ABNF_INTERNAL_CIRCULAR;
-	if (abnf_resolve_rule_alternation_dependencies(stream, pr, pr->alternation, pr_arr, n) < 0) {
-		ret = -1;
+static int abnf_scc_cmp_order(const void *a, const void *b) {
+	unsigned int oa, ob;
+	oa = (*(struct abnf_rule **) a)->internal.order;
+	ob = (*(struct abnf_rule **) b)->internal.order;
+	return oa < ob ? -1 : (oa > ob ? 1 : 0);
+}
+
+static void abnf_scc_visit(struct abnf_scc_state *st, struct abnf_rule *pr) {
+	unsigned int i, k;
+	int self_ref = 0;
+	pr->internal.index = pr->internal.lowlink = st->counter++;
+	pr->internal.flags |= ABNF_INTERNAL_VISITED | ABNF_INTERNAL_ONSTACK;
+	st->stack[st->sp++] = pr;
+	abnf_scc_alternations(st, pr, pr->alternation, &self_ref);
+	pr->internal.order = st->order++;
+	if (pr->internal.lowlink != pr->internal.index)
+		return;  /* pr is part of component rooted below in stack */
+
+	for (k = st->sp; st->stack[k-1] != pr; k--);
+	/* keep depth first post order within component */
+	if (st->sp - k > 0)
+		qsort(st->stack + k - 1, st->sp - k + 1, sizeof(*st->stack), abnf_scc_cmp_order);
+	if (st->sp - k > 0 || self_ref) {
+		st->groups++;
+		fprintf(st->stream, "circular dependency in rule group #%u:", st->groups);
+		for (i = k-1; i < st->sp; i++) {
+			fprintf(st->stream, " '%.*s'", st->stack[i]->name.len, st->stack[i]->name.s);
+		}
+		fprintf(st->stream, "\n");
 	}
-	pr_arr[*n] = pr;
-	(*n)++;
-	pr->internal.flags |= ABNF_INTERNAL_RESOLVED;
-	return ret;
+	for (i = k-1; i < st->sp; i++) {
+		st->stack[i]->internal.flags &= ~ABNF_INTERNAL_ONSTACK;
+		st->stack[i]->internal.flags |= ABNF_INTERNAL_RESOLVED;
+		if (st->sp - k > 0 || self_ref)
+			st->stack[i]->internal.flags |= ABNF_INTERNAL_CIRCULAR;
+		st->pr_arr[st->n++] = st->stack[i];
+	}
+	st->sp = k-1;
 }
 
 int abnf_resolve_rule_dependencies(FILE *stream, struct abnf_rule **rules) {
 
-	struct abnf_rule **pr_arr, *pr, *pr2;
+	struct abnf_rule *pr;
+	struct abnf_scc_state st;
 	unsigned int n, i;
-	int ret = 0;
 	/* we must reorder rules because ragel does not support forward links */
 	for (pr = *rules, n=0; pr; pr = pr->next, n++) {
-		pr->internal.flags &= ~ABNF_INTERNAL_RESOLVED;
+		pr->internal.flags &= ~(ABNF_INTERNAL_RESOLVED|ABNF_INTERNAL_CIRCULAR|ABNF_INTERNAL_VISITED|ABNF_INTERNAL_ONSTACK);
+	}
+	if (n == 0) return 0;
+	st.stream = stream;
+	st.pr_arr = abnf_malloc(sizeof(*st.pr_arr)*n);
+	st.stack = abnf_malloc(sizeof(*st.stack)*n);
+	if (!st.pr_arr || !st.stack) {
+		if (st.pr_arr) abnf_free(st.pr_arr);
+		if (st.stack) abnf_free(st.stack);
+		return -1;
 	}
-	if (n <= 1) return 0;
-	pr_arr = abnf_malloc(sizeof(*pr_arr)*n);
-	if (!pr_arr) return -1;
+	st.sp = st.counter = st.order = st.n = st.groups = 0;
 
-	n = 0;
 	for (pr = *rules; pr; pr = pr->next) {
-		if (pr->internal.flags & ABNF_INTERNAL_RESOLVED) continue;
-		for (pr2 = *rules; pr2; pr2 = pr2->next) {
-			pr2->internal.flags &= ~ABNF_INTERNAL_CIRCULAR; /* reset circualar flag */
-		}
-		if (abnf_resolve_rule2_dependencies(stream, pr, pr_arr, &n) < 0) {
-			ret = -1;
-		}
+		if (pr->internal.flags & ABNF_INTERNAL_VISITED) continue;
+		abnf_scc_visit(&st, pr);
 	}
 	/* reorder rule chain */
-	for (i=0; i<n; i++) {
+	for (i=0; i<st.n; i++) {
 		if (i>0) {
-			pr_arr[i-1]->next = pr_arr[i];
-			pr_arr[i]->prev = pr_arr[i-1];
+			st.pr_arr[i-1]->next = st.pr_arr[i];
+			st.pr_arr[i]->prev = st.pr_arr[i-1];
 		}
 		else {
-			*rules = pr_arr[i];
-			pr_arr[i]->prev = NULL;
+			*rules = st.pr_arr[i];
+			st.pr_arr[i]->prev = NULL;
+		}
+		st.pr_arr[i]->next = NULL;
+	}
+	abnf_free(st.pr_arr);
+	abnf_free(st.stack);
+	return st.groups?-1:0;
+}
+
+/* pushes rules referenced by alternations which are not yet reached */
+static void abnf_reach_alternations(struct abnf_grammar *g, struct abnf_alternation *pa, struct abnf_rule **stack, unsigned int *sp) {
+	struct abnf_concatenation *pc;
+	struct abnf_element *e;
+	struct abnf_rule *pr;
+	for (; pa; pa = pa->next) {
+		for (pc = pa->concatenation; pc; pc = pc->next) {
+			e = &pc->repetition.element;
+			if (e->type == ABNF_ET_RULE) {
+				pr = e->u.rule.resolved?e->u.rule.resolved:abnf_grammar_find_rule(g, e->u.rule.name);
+				if (pr && (pr->internal.flags & ABNF_INTERNAL_VISITED) == 0) {
+					pr->internal.flags |= ABNF_INTERNAL_VISITED;
+					stack[(*sp)++] = pr;
+				}
+			}
+			else if (e->type == ABNF_ET_GROUP) {
+				abnf_reach_alternations(g, e->u.group, stack, sp);
+			}
 		}
-		pr_arr[i]->next = NULL;
 	}
-	abnf_free(pr_arr);
-	return ret;
+}
+
+int abnf_select_rules(struct abnf_grammar *g, struct abnf_str *start, unsigned int start_count) {
+	FILE *stream = abnf_ctx_diag(g->ctx);
+	struct abnf_rule *pr, *next, **stack;
+	unsigned int n, i, sp;
+	int removed;
+
+	for (pr = g->rules, n = 0; pr; pr = pr->next, n++) {
+		pr->internal.flags &= ~(ABNF_INTERNAL_VISITED|ABNF_INTERNAL_START);
+	}
+	stack = abnf_malloc(sizeof(*stack)*(n?n:1));
+	if (!stack) {
+		fprintf(stream, "ERROR: not enough memory\n");
+		return -1;
+	}
+	sp = 0;
+	for (i = 0; i < start_count; i++) {
+		pr = abnf_grammar_find_rule(g, start[i]);
+		if (!pr) {
+			fprintf(stream, "ERROR: start rule '%.*s' not found\n", start[i].len, start[i].s);
+			abnf_free(stack);
+			return -1;
+		}
+		pr->internal.flags |= ABNF_INTERNAL_START;
+		if ((pr->internal.flags & ABNF_INTERNAL_VISITED) == 0) {
+			pr->internal.flags |= ABNF_INTERNAL_VISITED;
+			stack[sp++] = pr;
+		}
+	}
+	/* each rule is pushed once so stack cannot overflow */
+	while (sp > 0) {
+		pr = stack[--sp];
+		abnf_reach_alternations(g, pr->alternation, stack, &sp);
+	}
+	abnf_free(stack);
+
+	removed = 0;
+	for (pr = g->rules; pr; pr = next) {
+		next = pr->next;
+		if (pr->internal.flags & ABNF_INTERNAL_VISITED) {
+			pr->internal.flags &= ~ABNF_INTERNAL_VISITED;
+		}
+		else {
+			abnf_grammar_remove_rule(g, pr);
+			removed++;
+		}
+	}
+	return removed;
 }
 
 void abnf_print_header(FILE *stream, struct abnf_print_info *info, struct abnf_print_comment *comment_def) {
 	int i;
 	if (info) {
 		time_t t;
-		char *lc;
+		struct tm tm;
+		char *lc, tbuff[26];  /* printers may run concurrently */
 		lc = comment_def->line_comment?comment_def->line_comment:"";
-		t = time(NULL);
 		if (comment_def->pre_comment)
 			fprintf(stream, "%s", comment_def->pre_comment);
-		fprintf(stream, "%sGenerated by abnfc at %s", lc, ctime(&t));
+		if (info->flags & ABNF_PRINT_NO_DATE) {
+			fprintf(stream, "%sGenerated by abnfc\n", lc);
+		}
+		else {
+			/* fixed date keeps output reproducible */
+			if (info->date && gmtime_r(&info->date, &tm)) {
+				asctime_r(&tm, tbuff);
+			}
+			else {
+				t = time(NULL);
+				ctime_r(&t, tbuff);
+			}
+			fprintf(stream, "%sGenerated by abnfc at %s", lc, tbuff);
+		}
 		if (info->out_file.len) {
 			fprintf(stream, "%sOutput file: %.*s\n", lc, info->out_file.len, info->out_file.s);
 		}
@@ -474,1003 +990,530 @@ void abnf_print_header(FILE *stream, struct abnf_print_info *info, struct abnf_p
 
 }
 
-/* gramatic declarations */
-struct abnf_rule* abnf_declare_core_rules(struct abnf_rule* next) {
-
-	struct abnf_rule *rule_list;
-
-	rule_list =
-		abnf_add_rule(
-			abnf_mk_str("ALPHA"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_range(0x41, 0x5A)
-					),
-					NULL  /* end of concatenations */
-				),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_range(0x61, 0x7A)
-					),
-					NULL  /* end of concatenations */
-				),
-				NULL  /* end of alternations */
-			)),
-		abnf_add_rule(
-			abnf_mk_str("BIT"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_char('0')
-					),
-					NULL  /* end of concatenations */
-				),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_char('1')
-					),
-					NULL  /* end of concatenations */
-				),
-				NULL  /* end of alternations */
-			)),
-		abnf_add_rule(
-			abnf_mk_str("CHAR"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_range(0x01, 0x7F)
-					),
-					NULL  /* end of concatenations */
-				),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("CR"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_char(0x0D)
-					),
-					NULL  /* end of concatenations */
-				),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("CRLF"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("CR"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("LF"))
-					),
-					NULL  /* end of concatenations */
-				)),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("CTL"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_range(0x00, 0x1F)
-					),
-					NULL  /* end of concatenations */
-				),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_char(0x7F)
-					),
-					NULL  /* end of concatenations */
-				),
-				NULL  /* end of alternations */
-			)),
-		abnf_add_rule(
-			abnf_mk_str("DIGIT"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_range(0x30, 0x39)
-					),
-					NULL  /* end of concatenations */
-				),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("DQUOTE"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_char(0x22)
-					),
-					NULL  /* end of concatenations */
-				),
-				NULL  /* end of alternations */
-			),
-
-		abnf_add_rule(
-			abnf_mk_str("HEXDIG"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("DIGIT"))
-					),
-					NULL  /* end of concatenations */
-				),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_token(abnf_mk_str("A"))
-					),
-					NULL  /* end of concatenations */
-				),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_token(abnf_mk_str("B"))
-					),
-					NULL  /* end of concatenations */
-				),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_token(abnf_mk_str("C"))
-					),
-					NULL  /* end of concatenations */
-				),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_token(abnf_mk_str("D"))
-					),
-					NULL  /* end of concatenations */
-				),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_token(abnf_mk_str("E"))
-					),
-					NULL  /* end of concatenations */
-				),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_token(abnf_mk_str("F"))
-					),
-					NULL  /* end of concatenations */
-				),
-				NULL  /* end of alternations */
-			))))))),
-		abnf_add_rule(
-			abnf_mk_str("HTAB"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_char(0x09)
-					),
-					NULL  /* end of concatenations */
-				),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("LF"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_char(0x0A)
-					),
-					NULL  /* end of concatenations */
-				),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("LWSP"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_any(
-						abnf_mk_element_group(
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_rule(abnf_mk_str("WSP"))
-									),
-									NULL  /* end of concatenations */
-								),
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_rule(abnf_mk_str("CRLF"))
-									),
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_rule(abnf_mk_str("WSP"))
-									),
-									NULL  /* end of concatenations */
-								)),
-								NULL  /* end of alternations */
-							))
-						)
-					),
-					NULL  /* end of concatenations */
-				),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("OCTET"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_range(0x00, 0xFF)
-					),
-					NULL  /* end of concatenations */
-				),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("SP"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_char(0x20)
-					),
-					NULL  /* end of concatenations */
-				),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("VCHAR"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_range(0x21, 0x7E)
-					),
-					NULL  /* end of concatenations */
-				),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("WSP"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("SP"))
-					),
-					NULL  /* end of concatenations */
-				),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("HTAB"))
-					),
-					NULL  /* end of concatenations */
-				),
-				NULL  /* end of alternations */
-			)),
-
-			next   /* end of rules */
-		))))))))))))))));
-
-	abnf_rule_assign_origin(rule_list, next, abnf_mk_str("RFC2234 Core"));
-	return rule_list;
-}
-
-struct abnf_rule* abnf_declare_abnf_rules(struct abnf_rule* next) {
-
-	struct abnf_rule *rule_list;
-
-	rule_list =
-		abnf_add_rule(
-			abnf_mk_str("rulelist"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_more(
-						abnf_mk_element_group(
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_rule(abnf_mk_str("rule"))
-									),
-									NULL  /* end of concatenations */
-								),
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_any(
-										abnf_mk_element_rule(abnf_mk_str("c-wsp"))
-									),
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_rule(abnf_mk_str("c-nl"))
-									),
-									NULL  /* end of concatenations */
-								)),
-								NULL  /* end of alternations */
-							))
-						)
-					),
-					NULL  /* end of concatenations */
-				),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("rule"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("rulename"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("defined-as"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("elements"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("c-nl"))
-					),
-					NULL  /* end of concatenations */
-				)))),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("rulename"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("ALPHA"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_any(
-						abnf_mk_element_group(
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_rule(abnf_mk_str("ALPHA"))
-									),
-									NULL  /* end of concatenations */
-								),
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_rule(abnf_mk_str("DIGIT"))
-									),
-									NULL  /* end of concatenations */
-								),
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_char('-')
-									),
-									NULL  /* end of concatenations */
-								),
-								NULL  /* end of alternations */
-							)))
-						)
-					),
-					NULL  /* end of concatenations */
-				)),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("defined-as"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_any(
-						abnf_mk_element_rule(abnf_mk_str("c-wsp"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_group(
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_char('=')
-									),
-									NULL  /* end of concatenations */
-								),
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_token(abnf_mk_str("=/"))
-									),
-									NULL  /* end of concatenations */
-								),
-								NULL  /* end of alternations */
-							))
-						)
-					),
-				abnf_add_concatenation(
-					abnf_mk_any(
-						abnf_mk_element_rule(abnf_mk_str("c-wsp"))
-					),
-					NULL  /* end of concatenations */
-				))),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("elements"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("alternation"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_any(
-						abnf_mk_element_rule(abnf_mk_str("c-wsp"))
-					),
-					NULL  /* end of concatenations */
-				)),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("c-wsp"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("WSP"))
-					),
-					NULL  /* end of concatenations */
-				),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("c-nl"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("WSP"))
-					),
-					NULL  /* end of concatenations */
-				)),
-				NULL  /* end of alternations */
-			)),
-		abnf_add_rule(
-			abnf_mk_str("c-nl"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("comment"))
-					),
-					NULL  /* end of concatenations */
-				),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("CRLF"))
-					),
-					NULL  /* end of concatenations */
-				),
-				NULL  /* end of alternations */
-			)),
-		abnf_add_rule(
-			abnf_mk_str("comment"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_char(';')
-					),
-				abnf_add_concatenation(
-					abnf_mk_any(
-						abnf_mk_element_group(
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_rule(abnf_mk_str("WSP"))
-									),
-									NULL  /* end of concatenations */
-								),
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_rule(abnf_mk_str("VCHAR"))
-									),
-									NULL  /* end of concatenations */
-								),
-								NULL  /* end of alternations */
-							))
-						)
-					),
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("CRLF"))
-					),
-					NULL  /* end of concatenations */
-				))),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("alternation"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("concatenation"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_any(
-						abnf_mk_element_group(
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_any(
-										abnf_mk_element_rule(abnf_mk_str("c-wsp"))
-									),
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_char('/')
-									),
-								abnf_add_concatenation(
-									abnf_mk_any(
-										abnf_mk_element_rule(abnf_mk_str("c-wsp"))
-									),
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_rule(abnf_mk_str("concatenation"))
-									),
-									NULL  /* end of concatenations */
-								)))),
-								NULL  /* end of alternations */
-							)
-						)
-					),
-					NULL  /* end of concatenations */
-				)),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("concatenation"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("repetition"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_any(
-						abnf_mk_element_group(
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_more(
-										abnf_mk_element_rule(abnf_mk_str("c-wsp"))
-									),
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_rule(abnf_mk_str("repetition"))
-									),
-									NULL  /* end of concatenations */
-								)),
-								NULL  /* end of alternations */
-							)
-						)
-					),
-					NULL  /* end of concatenations */
-				)),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("repetition"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_optional(
-						abnf_mk_element_rule(abnf_mk_str("repeat"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("element"))
-					),
-					NULL  /* end of concatenations */
-				)),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("repeat"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_more(
-						abnf_mk_element_rule(abnf_mk_str("DIGIT"))
-					),
-					NULL  /* end of concatenations */
-				),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_any(
-						abnf_mk_element_rule(abnf_mk_str("DIGIT"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_char('*')
-					),
-				abnf_add_concatenation(
-					abnf_mk_any(
-						abnf_mk_element_rule(abnf_mk_str("DIGIT"))
-					),
-					NULL  /* end of concatenations */
-				))),
-				NULL  /* end of alternations */
-			)),
-		abnf_add_rule(
-			abnf_mk_str("element"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("rulename"))
-					),
-					NULL  /* end of concatenations */
-				),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("group"))
-					),
-					NULL  /* end of concatenations */
-				),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("option"))
-					),
-					NULL  /* end of concatenations */
-				),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("char-val"))
-					),
-					NULL  /* end of concatenations */
-				),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("num-val"))
-					),
-					NULL  /* end of concatenations */
-				),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("prose-val"))
-					),
-					NULL  /* end of concatenations */
-				),
-				NULL  /* end of alternations */
-			)))))),
-		abnf_add_rule(
-			abnf_mk_str("group"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_char('(')
-					),
-				abnf_add_concatenation(
-					abnf_mk_any(
-						abnf_mk_element_rule(abnf_mk_str("c-wsp"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("alternation"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_any(
-						abnf_mk_element_rule(abnf_mk_str("c-wsp"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_char(')')
-					),
-					NULL  /* end of concatenations */
-				))))),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("option"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_char('[')
-					),
-				abnf_add_concatenation(
-					abnf_mk_any(
-						abnf_mk_element_rule(abnf_mk_str("c-wsp"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("alternation"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_any(
-						abnf_mk_element_rule(abnf_mk_str("c-wsp"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_char(']')
-					),
-					NULL  /* end of concatenations */
-				))))),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("char-val"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("DQUOTE"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_any(
-						abnf_mk_element_group(
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_range(0x20, 0x21)
-									),
-									NULL  /* end of concatenations */
-								),
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_range(0x23, 0x7E)
-									),
-									NULL  /* end of concatenations */
-								),
-								NULL  /* end of alternations */
-							))
-						)
-					),
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_rule(abnf_mk_str("DQUOTE"))
-					),
-					NULL  /* end of concatenations */
-				))),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("num-val"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_char('%')
-					),
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_group(
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_rule(abnf_mk_str("bin-val"))
-									),
-									NULL  /* end of concatenations */
-								),
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_rule(abnf_mk_str("dec-val"))
-									),
-									NULL  /* end of concatenations */
-								),
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_rule(abnf_mk_str("hex-val"))
-									),
-									NULL  /* end of concatenations */
-								),
-								NULL  /* end of alternations */
-							)))
-						)
-					),
-					NULL  /* end of concatenations */
-				)),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("bin-val"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_token(abnf_mk_str("b"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_more(
-						abnf_mk_element_rule(abnf_mk_str("BIT"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_optional(
-						abnf_mk_element_group(
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_more(
-										abnf_mk_element_group(
-											abnf_add_alternation(
-												abnf_add_concatenation(
-													abnf_mk_once(
-														abnf_mk_element_char('.')
-													),
-												abnf_add_concatenation(
-													abnf_mk_more(
-														abnf_mk_element_rule(abnf_mk_str("BIT"))
-													),
-													NULL  /* end of concatenations */
-												)),
-												NULL  /* end of alternations */
-											)
-										)
-									),
-									NULL  /* end of concatenations */
-								),
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_char('-')
-									),
-								abnf_add_concatenation(
-									abnf_mk_more(
-										abnf_mk_element_rule(abnf_mk_str("BIT"))
-									),
-									NULL  /* end of concatenations */
-								)),
-								NULL  /* end of alternations */
-							))
-						)
-					),
-					NULL  /* end of concatenations */
-				))),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("dec-val"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_token(abnf_mk_str("d"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_more(
-						abnf_mk_element_rule(abnf_mk_str("DIGIT"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_optional(
-						abnf_mk_element_group(
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_more(
-										abnf_mk_element_group(
-											abnf_add_alternation(
-												abnf_add_concatenation(
-													abnf_mk_once(
-														abnf_mk_element_char('.')
-													),
-												abnf_add_concatenation(
-													abnf_mk_more(
-														abnf_mk_element_rule(abnf_mk_str("DIGIT"))
-													),
-													NULL  /* end of concatenations */
-												)),
-												NULL  /* end of alternations */
-											)
-										)
-									),
-									NULL  /* end of concatenations */
-								),
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_char('-')
-									),
-								abnf_add_concatenation(
-									abnf_mk_more(
-										abnf_mk_element_rule(abnf_mk_str("DIGIT"))
-									),
-									NULL  /* end of concatenations */
-								)),
-								NULL  /* end of alternations */
-							))
-						)
-					),
-					NULL  /* end of concatenations */
-				))),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("hex-val"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_token(abnf_mk_str("x"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_more(
-						abnf_mk_element_rule(abnf_mk_str("HEXDIG"))
-					),
-				abnf_add_concatenation(
-					abnf_mk_optional(
-						abnf_mk_element_group(
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_more(
-										abnf_mk_element_group(
-											abnf_add_alternation(
-												abnf_add_concatenation(
-													abnf_mk_once(
-														abnf_mk_element_char('.')
-													),
-												abnf_add_concatenation(
-													abnf_mk_more(
-														abnf_mk_element_rule(abnf_mk_str("HEXDIG"))
-													),
-													NULL  /* end of concatenations */
-												)),
-												NULL  /* end of alternations */
-											)
-										)
-									),
-									NULL  /* end of concatenations */
-								),
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_char('-')
-									),
-								abnf_add_concatenation(
-									abnf_mk_more(
-										abnf_mk_element_rule(abnf_mk_str("HEXDIG"))
-									),
-									NULL  /* end of concatenations */
-								)),
-								NULL  /* end of alternations */
-							))
-						)
-					),
-					NULL  /* end of concatenations */
-				))),
-				NULL  /* end of alternations */
-			),
-		abnf_add_rule(
-			abnf_mk_str("prose-val"),
-			abnf_add_alternation(
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_char('<')
-					),
-				abnf_add_concatenation(
-					abnf_mk_any(
-						abnf_mk_element_group(
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_range(0x20, 0x3D)
-									),
-									NULL  /* end of concatenations */
-								),
-							abnf_add_alternation(
-								abnf_add_concatenation(
-									abnf_mk_once(
-										abnf_mk_element_range(0x3F, 0x7E)
-									),
-									NULL  /* end of concatenations */
-								),
-								NULL  /* end of alternations */
-							))
-						)
-					),
-				abnf_add_concatenation(
-					abnf_mk_once(
-						abnf_mk_element_char('>')
-					),
-					NULL  /* end of concatenations */
-				))),
-				NULL  /* end of alternations */
-			),
-			next   /* end of rules */
-		)))))))))))))))))))));
-
-	abnf_rule_assign_origin(rule_list, next, abnf_mk_str("RFC2234 ABNF"));
-
-	return rule_list;
+void abnf_writer_init(struct abnf_writer *w, FILE *stream) {
+	w->stream = stream;
+	w->len = 0;
+	w->err = 0;
+}
+
+int abnf_writer_flush(struct abnf_writer *w) {
+	if (w->len && fwrite(w->buff, 1, w->len, w->stream) != w->len)
+		w->err = 1;
+	w->len = 0;
+	return w->err ? -1 : 0;
+}
+
+void abnf_write(struct abnf_writer *w, const char *s, size_t len) {
+	if (w->len + len > ABNF_WRITER_SIZE) {
+		abnf_writer_flush(w);
+		if (len >= ABNF_WRITER_SIZE) {
+			if (fwrite(s, 1, len, w->stream) != len)
+				w->err = 1;
+			return;
+		}
+	}
+	memcpy(w->buff + w->len, s, len);
+	w->len += len;
+}
+
+void abnf_write_cstr(struct abnf_writer *w, const char *s) {
+	abnf_write(w, s, strlen(s));
+}
+
+void abnf_write_rep_char(struct abnf_writer *w, char c, int n) {
+	size_t k;
+	while (n > 0) {
+		if (w->len >= ABNF_WRITER_SIZE) abnf_writer_flush(w);
+		k = ABNF_WRITER_SIZE - w->len;
+		if (k > n) k = n;
+		memset(w->buff + w->len, c, k);
+		w->len += k;
+		n -= k;
+	}
+}
+
+void abnf_write_hex(struct abnf_writer *w, unsigned char c) {
+	static const char digits[] = "0123456789abcdef";
+	if (w->len + 2 > ABNF_WRITER_SIZE) abnf_writer_flush(w);
+	w->buff[w->len++] = digits[c >> 4];
+	w->buff[w->len++] = digits[c & 0x0f];
+}
+
+void abnf_write_uint(struct abnf_writer *w, unsigned int n) {
+	char s[sizeof(n)*3];
+	int i = sizeof(s);
+	do {
+		s[--i] = '0' + n % 10;
+		n /= 10;
+	} while (n);
+	abnf_write(w, s+i, sizeof(s)-i);
+}
+
+void abnf_writef(struct abnf_writer *w, const char *fmt, ...) {
+	va_list ap;
+	int n;
+	va_start(ap, fmt);
+	n = vsnprintf(w->buff + w->len, ABNF_WRITER_SIZE - w->len, fmt, ap);
+	va_end(ap);
+	if (n < 0) {
+		w->err = 1;
+		return;
+	}
+	if (n < ABNF_WRITER_SIZE - w->len) {
+		w->len += n;
+		return;
+	}
+	/* does not fit, longer than buffer goes directly to stream */
+	abnf_writer_flush(w);
+	va_start(ap, fmt);
+	if (n < ABNF_WRITER_SIZE)
+		w->len = vsnprintf(w->buff, ABNF_WRITER_SIZE, fmt, ap);
+	else if (vfprintf(w->stream, fmt, ap) < 0)
+		w->err = 1;
+	va_end(ap);
+}
+
+/* gramatic declarations, generated by "abnfc -f self -n core|abnf" */
+/* RFC2234 Core rules */
+static const struct abnf_bin_rule core_rules[] = {
+	/* name, name_len, origin, origin_len, alternation, flags, hash, hash_next */
+	{0, 5, 5, 12, 1, 0, 0x5d8b6dab, 0},  /* 1: ALPHA */
+	{17, 3, 5, 12, 3, 0, 0x60cae230, 4},  /* 2: BIT */
+	{20, 4, 5, 12, 5, 0, 0xa84c031d, 16},  /* 3: CHAR */
+	{24, 2, 5, 12, 6, 0, 0x45297660, 13},  /* 4: CR */
+	{26, 4, 5, 12, 7, 0, 0x725a88a6, 7},  /* 5: CRLF */
+	{34, 3, 5, 12, 8, 0, 0x1054181a, 9},  /* 6: CTL */
+	{37, 5, 5, 12, 10, 0, 0x885c8a56, 14},  /* 7: DIGIT */
+	{42, 6, 5, 12, 11, 0, 0x28a52b75, 0},  /* 8: DQUOTE */
+	{48, 6, 5, 12, 12, 0, 0x1e26307a, 0},  /* 9: HEXDIG */
+	{65, 4, 5, 12, 19, 0, 0xbd7e793e, 0},  /* 10: HTAB */
+	{69, 2, 5, 12, 20, 0, 0x4b31ce97, 0},  /* 11: LF */
+	{71, 4, 5, 12, 21, 0, 0x0cc32fef, 0},  /* 12: LWSP */
+	{85, 5, 5, 12, 24, 0, 0x1289a690, 0},  /* 13: OCTET */
+	{90, 2, 5, 12, 25, 0, 0x47521bf6, 0},  /* 14: SP */
+	{92, 5, 5, 12, 26, 0, 0xbbf37171, 0},  /* 15: VCHAR */
+	{97, 3, 5, 12, 27, 0, 0x29b7533d, 0},  /* 16: WSP */
+};
+
+static const struct abnf_bin_alternation core_alternations[] = {
+	/* concatenation, next */
+	{1, 2},  /* 1 */
+	{2, 0},  /* 2 */
+	{3, 4},  /* 3 */
+	{4, 0},  /* 4 */
+	{5, 0},  /* 5 */
+	{6, 0},  /* 6 */
+	{7, 0},  /* 7 */
+	{9, 9},  /* 8 */
+	{10, 0},  /* 9 */
+	{11, 0},  /* 10 */
+	{12, 0},  /* 11 */
+	{13, 13},  /* 12 */
+	{14, 14},  /* 13 */
+	{15, 15},  /* 14 */
+	{16, 16},  /* 15 */
+	{17, 17},  /* 16 */
+	{18, 18},  /* 17 */
+	{19, 0},  /* 18 */
+	{20, 0},  /* 19 */
+	{21, 0},  /* 20 */
+	{22, 0},  /* 21 */
+	{23, 23},  /* 22 */
+	{24, 0},  /* 23 */
+	{26, 0},  /* 24 */
+	{27, 0},  /* 25 */
+	{28, 0},  /* 26 */
+	{29, 28},  /* 27 */
+	{30, 0},  /* 28 */
+};
+
+static const struct abnf_bin_concatenation core_concatenations[] = {
+	/* min, max, type, a, b, next */
+	{1, 1, ABNF_ET_RANGE, 0x41, 0x5a, 0},  /* 1 */
+	{1, 1, ABNF_ET_RANGE, 0x61, 0x7a, 0},  /* 2 */
+	{1, 1, ABNF_ET_RANGE, 0x30, 0x30, 0},  /* 3 */
+	{1, 1, ABNF_ET_RANGE, 0x31, 0x31, 0},  /* 4 */
+	{1, 1, ABNF_ET_RANGE, 0x01, 0x7f, 0},  /* 5 */
+	{1, 1, ABNF_ET_RANGE, 0x0d, 0x0d, 0},  /* 6 */
+	{1, 1, ABNF_ET_RULE, 30, 2, 8},  /* 7 */
+	{1, 1, ABNF_ET_RULE, 32, 2, 0},  /* 8 */
+	{1, 1, ABNF_ET_RANGE, 0x00, 0x1f, 0},  /* 9 */
+	{1, 1, ABNF_ET_RANGE, 0x7f, 0x7f, 0},  /* 10 */
+	{1, 1, ABNF_ET_RANGE, 0x30, 0x39, 0},  /* 11 */
+	{1, 1, ABNF_ET_RANGE, 0x22, 0x22, 0},  /* 12 */
+	{1, 1, ABNF_ET_RULE, 54, 5, 0},  /* 13 */
+	{1, 1, ABNF_ET_TOKEN, 59, 1, 0},  /* 14 */
+	{1, 1, ABNF_ET_TOKEN, 60, 1, 0},  /* 15 */
+	{1, 1, ABNF_ET_TOKEN, 61, 1, 0},  /* 16 */
+	{1, 1, ABNF_ET_TOKEN, 62, 1, 0},  /* 17 */
+	{1, 1, ABNF_ET_TOKEN, 63, 1, 0},  /* 18 */
+	{1, 1, ABNF_ET_TOKEN, 64, 1, 0},  /* 19 */
+	{1, 1, ABNF_ET_RANGE, 0x09, 0x09, 0},  /* 20 */
+	{1, 1, ABNF_ET_RANGE, 0x0a, 0x0a, 0},  /* 21 */
+	{0, ABNF_INFINITY, ABNF_ET_GROUP, 22, 0, 0},  /* 22 */
+	{1, 1, ABNF_ET_RULE, 75, 3, 0},  /* 23 */
+	{1, 1, ABNF_ET_RULE, 78, 4, 25},  /* 24 */
+	{1, 1, ABNF_ET_RULE, 82, 3, 0},  /* 25 */
+	{1, 1, ABNF_ET_RANGE, 0x00, 0xff, 0},  /* 26 */
+	{1, 1, ABNF_ET_RANGE, 0x20, 0x20, 0},  /* 27 */
+	{1, 1, ABNF_ET_RANGE, 0x21, 0x7e, 0},  /* 28 */
+	{1, 1, ABNF_ET_RULE, 100, 2, 0},  /* 29 */
+	{1, 1, ABNF_ET_RULE, 102, 4, 0},  /* 30 */
+};
+
+static const uint32_t core_index[] = {
+	2, 15, 0, 0, 0, 8, 5, 11, 0, 0, 6, 1, 0, 3, 10, 12,
+};
+
+static const char core_strings[] =
+	"ALPHA"  /* 0 */
+	"RFC2234 Core"  /* 5 */
+	"BIT"  /* 17 */
+	"CHAR"  /* 20 */
+	"CR"  /* 24 */
+	"CRLF"  /* 26 */
+	"CR"  /* 30 */
+	"LF"  /* 32 */
+	"CTL"  /* 34 */
+	"DIGIT"  /* 37 */
+	"DQUOTE"  /* 42 */
+	"HEXDIG"  /* 48 */
+	"DIGIT"  /* 54 */
+	"A"  /* 59 */
+	"B"  /* 60 */
+	"C"  /* 61 */
+	"D"  /* 62 */
+	"E"  /* 63 */
+	"F"  /* 64 */
+	"HTAB"  /* 65 */
+	"LF"  /* 69 */
+	"LWSP"  /* 71 */
+	"WSP"  /* 75 */
+	"CRLF"  /* 78 */
+	"WSP"  /* 82 */
+	"OCTET"  /* 85 */
+	"SP"  /* 90 */
+	"VCHAR"  /* 92 */
+	"WSP"  /* 97 */
+	"SP"  /* 100 */
+	"HTAB"  /* 102 */
+	;
+
+static const struct abnf_bin_tables core_tables = {
+	.rules = core_rules,
+	.alternations = core_alternations,
+	.concatenations = core_concatenations,
+	.index = core_index,
+	.strings = core_strings,
+	.rule_count = 16,
+	.alternation_count = 28,
+	.concatenation_count = 30,
+	.index_size = 16,
+	.string_size = 106,
+};
+
+int abnf_declare_core_rules(struct abnf_grammar *g) {
+	return abnf_load_bin_tables(g, &core_tables, abnf_mk_str(NULL), 1);
 }
 
+/* RFC2234 ABNF definition of ABNF */
+static const struct abnf_bin_rule abnf_rules[] = {
+	/* name, name_len, origin, origin_len, alternation, flags, hash, hash_next */
+	{0, 8, 8, 12, 1, 0, 0x57abe25b, 0},  /* 1: rulelist */
+	{33, 4, 8, 12, 4, 0, 0xfc2e40d3, 0},  /* 2: rule */
+	{67, 8, 8, 12, 5, 0, 0x7326d818, 18},  /* 3: rulename */
+	{90, 10, 8, 12, 9, 0, 0x1645c7a5, 0},  /* 4: defined-as */
+	{112, 8, 8, 12, 12, 0, 0x5a94b0cc, 14},  /* 5: elements */
+	{136, 5, 8, 12, 13, 0, 0x6001a475, 0},  /* 6: c-wsp */
+	{151, 4, 8, 12, 15, 0, 0x03c152cf, 0},  /* 7: c-nl */
+	{166, 7, 8, 12, 17, 0, 0x67a6c45e, 0},  /* 8: comment */
+	{185, 11, 8, 12, 20, 0, 0x9f17ae24, 0},  /* 9: alternation */
+	{232, 13, 8, 12, 22, 0, 0xcc24f463, 0},  /* 10: concatenation */
+	{270, 10, 8, 12, 24, 0, 0x4d3bedc2, 0},  /* 11: repetition */
+	{293, 6, 8, 12, 25, 0, 0xd99ba82a, 0},  /* 12: repeat */
+	{314, 7, 8, 12, 27, 0, 0x4f4d3bf7, 0},  /* 13: element */
+	{364, 5, 8, 12, 33, 0, 0x5fb91e8c, 0},  /* 14: group */
+	{390, 6, 8, 12, 34, 0, 0xe7e19b94, 0},  /* 15: option */
+	{417, 8, 8, 12, 35, 0, 0x528633ff, 0},  /* 16: char-val */
+	{437, 7, 8, 12, 38, 0, 0x38550089, 19},  /* 17: num-val */
+	{465, 7, 8, 12, 42, 0, 0xeb06c778, 0},  /* 18: bin-val */
+	{482, 7, 8, 12, 46, 0, 0x70ddb129, 0},  /* 19: dec-val */
+	{505, 7, 8, 12, 50, 0, 0x5e2f9e5c, 0},  /* 20: hex-val */
+	{531, 9, 8, 12, 54, 0, 0xe4eff892, 0},  /* 21: prose-val */
+};
+
+static const struct abnf_bin_alternation abnf_alternations[] = {
+	/* concatenation, next */
+	{1, 0},  /* 1 */
+	{2, 3},  /* 2 */
+	{3, 0},  /* 3 */
+	{5, 0},  /* 4 */
+	{9, 0},  /* 5 */
+	{11, 7},  /* 6 */
+	{12, 8},  /* 7 */
+	{13, 0},  /* 8 */
+	{14, 0},  /* 9 */
+	{16, 11},  /* 10 */
+	{17, 0},  /* 11 */
+	{19, 0},  /* 12 */
+	{21, 14},  /* 13 */
+	{22, 0},  /* 14 */
+	{24, 16},  /* 15 */
+	{25, 0},  /* 16 */
+	{26, 0},  /* 17 */
+	{28, 19},  /* 18 */
+	{29, 0},  /* 19 */
+	{31, 0},  /* 20 */
+	{33, 0},  /* 21 */
+	{37, 0},  /* 22 */
+	{39, 0},  /* 23 */
+	{41, 0},  /* 24 */
+	{43, 26},  /* 25 */
+	{44, 0},  /* 26 */
+	{47, 28},  /* 27 */
+	{48, 29},  /* 28 */
+	{49, 30},  /* 29 */
+	{50, 31},  /* 30 */
+	{51, 32},  /* 31 */
+	{52, 0},  /* 32 */
+	{53, 0},  /* 33 */
+	{58, 0},  /* 34 */
+	{63, 0},  /* 35 */
+	{65, 37},  /* 36 */
+	{66, 0},  /* 37 */
+	{68, 0},  /* 38 */
+	{70, 40},  /* 39 */
+	{71, 41},  /* 40 */
+	{72, 0},  /* 41 */
+	{73, 0},  /* 42 */
+	{76, 45},  /* 43 */
+	{77, 0},  /* 44 */
+	{79, 0},  /* 45 */
+	{81, 0},  /* 46 */
+	{84, 49},  /* 47 */
+	{85, 0},  /* 48 */
+	{87, 0},  /* 49 */
+	{89, 0},  /* 50 */
+	{92, 53},  /* 51 */
+	{93, 0},  /* 52 */
+	{95, 0},  /* 53 */
+	{97, 0},  /* 54 */
+	{99, 56},  /* 55 */
+	{100, 0},  /* 56 */
+};
+
+static const struct abnf_bin_concatenation abnf_concatenations[] = {
+	/* min, max, type, a, b, next */
+	{1, ABNF_INFINITY, ABNF_ET_GROUP, 2, 0, 0},  /* 1 */
+	{1, 1, ABNF_ET_RULE, 20, 4, 0},  /* 2 */
+	{0, ABNF_INFINITY, ABNF_ET_RULE, 24, 5, 4},  /* 3 */
+	{1, 1, ABNF_ET_RULE, 29, 4, 0},  /* 4 */
+	{1, 1, ABNF_ET_RULE, 37, 8, 6},  /* 5 */
+	{1, 1, ABNF_ET_RULE, 45, 10, 7},  /* 6 */
+	{1, 1, ABNF_ET_RULE, 55, 8, 8},  /* 7 */
+	{1, 1, ABNF_ET_RULE, 63, 4, 0},  /* 8 */
+	{1, 1, ABNF_ET_RULE, 75, 5, 10},  /* 9 */
+	{0, ABNF_INFINITY, ABNF_ET_GROUP, 6, 0, 0},  /* 10 */
+	{1, 1, ABNF_ET_RULE, 80, 5, 0},  /* 11 */
+	{1, 1, ABNF_ET_RULE, 85, 5, 0},  /* 12 */
+	{1, 1, ABNF_ET_RANGE, 0x2d, 0x2d, 0},  /* 13 */
+	{0, ABNF_INFINITY, ABNF_ET_RULE, 100, 5, 15},  /* 14 */
+	{1, 1, ABNF_ET_GROUP, 10, 0, 18},  /* 15 */
+	{1, 1, ABNF_ET_RANGE, 0x3d, 0x3d, 0},  /* 16 */
+	{1, 1, ABNF_ET_TOKEN, 105, 2, 0},  /* 17 */
+	{0, ABNF_INFINITY, ABNF_ET_RULE, 107, 5, 0},  /* 18 */
+	{1, 1, ABNF_ET_RULE, 120, 11, 20},  /* 19 */
+	{0, ABNF_INFINITY, ABNF_ET_RULE, 131, 5, 0},  /* 20 */
+	{1, 1, ABNF_ET_RULE, 141, 3, 0},  /* 21 */
+	{1, 1, ABNF_ET_RULE, 144, 4, 23},  /* 22 */
+	{1, 1, ABNF_ET_RULE, 148, 3, 0},  /* 23 */
+	{1, 1, ABNF_ET_RULE, 155, 7, 0},  /* 24 */
+	{1, 1, ABNF_ET_RULE, 162, 4, 0},  /* 25 */
+	{1, 1, ABNF_ET_RANGE, 0x3b, 0x3b, 27},  /* 26 */
+	{0, ABNF_INFINITY, ABNF_ET_GROUP, 18, 0, 30},  /* 27 */
+	{1, 1, ABNF_ET_RULE, 173, 3, 0},  /* 28 */
+	{1, 1, ABNF_ET_RULE, 176, 5, 0},  /* 29 */
+	{1, 1, ABNF_ET_RULE, 181, 4, 0},  /* 30 */
+	{1, 1, ABNF_ET_RULE, 196, 13, 32},  /* 31 */
+	{0, ABNF_INFINITY, ABNF_ET_GROUP, 21, 0, 0},  /* 32 */
+	{0, ABNF_INFINITY, ABNF_ET_RULE, 209, 5, 34},  /* 33 */
+	{1, 1, ABNF_ET_RANGE, 0x2f, 0x2f, 35},  /* 34 */
+	{0, ABNF_INFINITY, ABNF_ET_RULE, 214, 5, 36},  /* 35 */
+	{1, 1, ABNF_ET_RULE, 219, 13, 0},  /* 36 */
+	{1, 1, ABNF_ET_RULE, 245, 10, 38},  /* 37 */
+	{0, ABNF_INFINITY, ABNF_ET_GROUP, 23, 0, 0},  /* 38 */
+	{1, ABNF_INFINITY, ABNF_ET_RULE, 255, 5, 40},  /* 39 */
+	{1, 1, ABNF_ET_RULE, 260, 10, 0},  /* 40 */
+	{0, 1, ABNF_ET_RULE, 280, 6, 42},  /* 41 */
+	{1, 1, ABNF_ET_RULE, 286, 7, 0},  /* 42 */
+	{1, ABNF_INFINITY, ABNF_ET_RULE, 299, 5, 0},  /* 43 */
+	{0, ABNF_INFINITY, ABNF_ET_RULE, 304, 5, 45},  /* 44 */
+	{1, 1, ABNF_ET_RANGE, 0x2a, 0x2a, 46},  /* 45 */
+	{0, ABNF_INFINITY, ABNF_ET_RULE, 309, 5, 0},  /* 46 */
+	{1, 1, ABNF_ET_RULE, 321, 8, 0},  /* 47 */
+	{1, 1, ABNF_ET_RULE, 329, 5, 0},  /* 48 */
+	{1, 1, ABNF_ET_RULE, 334, 6, 0},  /* 49 */
+	{1, 1, ABNF_ET_RULE, 340, 8, 0},  /* 50 */
+	{1, 1, ABNF_ET_RULE, 348, 7, 0},  /* 51 */
+	{1, 1, ABNF_ET_RULE, 355, 9, 0},  /* 52 */
+	{1, 1, ABNF_ET_RANGE, 0x28, 0x28, 54},  /* 53 */
+	{0, ABNF_INFINITY, ABNF_ET_RULE, 369, 5, 55},  /* 54 */
+	{1, 1, ABNF_ET_RULE, 374, 11, 56},  /* 55 */
+	{0, ABNF_INFINITY, ABNF_ET_RULE, 385, 5, 57},  /* 56 */
+	{1, 1, ABNF_ET_RANGE, 0x29, 0x29, 0},  /* 57 */
+	{1, 1, ABNF_ET_RANGE, 0x5b, 0x5b, 59},  /* 58 */
+	{0, ABNF_INFINITY, ABNF_ET_RULE, 396, 5, 60},  /* 59 */
+	{1, 1, ABNF_ET_RULE, 401, 11, 61},  /* 60 */
+	{0, ABNF_INFINITY, ABNF_ET_RULE, 412, 5, 62},  /* 61 */
+	{1, 1, ABNF_ET_RANGE, 0x5d, 0x5d, 0},  /* 62 */
+	{1, 1, ABNF_ET_RULE, 425, 6, 64},  /* 63 */
+	{0, ABNF_INFINITY, ABNF_ET_GROUP, 36, 0, 67},  /* 64 */
+	{1, 1, ABNF_ET_RANGE, 0x20, 0x21, 0},  /* 65 */
+	{1, 1, ABNF_ET_RANGE, 0x23, 0x7e, 0},  /* 66 */
+	{1, 1, ABNF_ET_RULE, 431, 6, 0},  /* 67 */
+	{1, 1, ABNF_ET_RANGE, 0x25, 0x25, 69},  /* 68 */
+	{1, 1, ABNF_ET_GROUP, 39, 0, 0},  /* 69 */
+	{1, 1, ABNF_ET_RULE, 444, 7, 0},  /* 70 */
+	{1, 1, ABNF_ET_RULE, 451, 7, 0},  /* 71 */
+	{1, 1, ABNF_ET_RULE, 458, 7, 0},  /* 72 */
+	{1, 1, ABNF_ET_TOKEN, 472, 1, 74},  /* 73 */
+	{1, ABNF_INFINITY, ABNF_ET_RULE, 473, 3, 75},  /* 74 */
+	{0, 1, ABNF_ET_GROUP, 43, 0, 0},  /* 75 */
+	{1, ABNF_INFINITY, ABNF_ET_GROUP, 44, 0, 0},  /* 76 */
+	{1, 1, ABNF_ET_RANGE, 0x2e, 0x2e, 78},  /* 77 */
+	{1, ABNF_INFINITY, ABNF_ET_RULE, 476, 3, 0},  /* 78 */
+	{1, 1, ABNF_ET_RANGE, 0x2d, 0x2d, 80},  /* 79 */
+	{1, ABNF_INFINITY, ABNF_ET_RULE, 479, 3, 0},  /* 80 */
+	{1, 1, ABNF_ET_TOKEN, 489, 1, 82},  /* 81 */
+	{1, ABNF_INFINITY, ABNF_ET_RULE, 490, 5, 83},  /* 82 */
+	{0, 1, ABNF_ET_GROUP, 47, 0, 0},  /* 83 */
+	{1, ABNF_INFINITY, ABNF_ET_GROUP, 48, 0, 0},  /* 84 */
+	{1, 1, ABNF_ET_RANGE, 0x2e, 0x2e, 86},  /* 85 */
+	{1, ABNF_INFINITY, ABNF_ET_RULE, 495, 5, 0},  /* 86 */
+	{1, 1, ABNF_ET_RANGE, 0x2d, 0x2d, 88},  /* 87 */
+	{1, ABNF_INFINITY, ABNF_ET_RULE, 500, 5, 0},  /* 88 */
+	{1, 1, ABNF_ET_TOKEN, 512, 1, 90},  /* 89 */
+	{1, ABNF_INFINITY, ABNF_ET_RULE, 513, 6, 91},  /* 90 */
+	{0, 1, ABNF_ET_GROUP, 51, 0, 0},  /* 91 */
+	{1, ABNF_INFINITY, ABNF_ET_GROUP, 52, 0, 0},  /* 92 */
+	{1, 1, ABNF_ET_RANGE, 0x2e, 0x2e, 94},  /* 93 */
+	{1, ABNF_INFINITY, ABNF_ET_RULE, 519, 6, 0},  /* 94 */
+	{1, 1, ABNF_ET_RANGE, 0x2d, 0x2d, 96},  /* 95 */
+	{1, ABNF_INFINITY, ABNF_ET_RULE, 525, 6, 0},  /* 96 */
+	{1, 1, ABNF_ET_RANGE, 0x3c, 0x3c, 98},  /* 97 */
+	{0, ABNF_INFINITY, ABNF_ET_GROUP, 55, 0, 101},  /* 98 */
+	{1, 1, ABNF_ET_RANGE, 0x20, 0x3d, 0},  /* 99 */
+	{1, 1, ABNF_ET_RANGE, 0x3f, 0x7e, 0},  /* 100 */
+	{1, 1, ABNF_ET_RANGE, 0x3e, 0x3e, 0},  /* 101 */
+};
+
+static const uint32_t abnf_index[] = {
+	0, 0, 11, 10, 9, 4, 0, 0, 0, 17, 12, 0, 5, 0, 0, 7,
+	0, 0, 21, 2, 15, 6, 0, 13, 3, 0, 0, 1, 20, 0, 8, 16,
+};
+
+static const char abnf_strings[] =
+	"rulelist"  /* 0 */
+	"RFC2234 ABNF"  /* 8 */
+	"rule"  /* 20 */
+	"c-wsp"  /* 24 */
+	"c-nl"  /* 29 */
+	"rule"  /* 33 */
+	"rulename"  /* 37 */
+	"defined-as"  /* 45 */
+	"elements"  /* 55 */
+	"c-nl"  /* 63 */
+	"rulename"  /* 67 */
+	"ALPHA"  /* 75 */
+	"ALPHA"  /* 80 */
+	"DIGIT"  /* 85 */
+	"defined-as"  /* 90 */
+	"c-wsp"  /* 100 */
+	"=/"  /* 105 */
+	"c-wsp"  /* 107 */
+	"elements"  /* 112 */
+	"alternation"  /* 120 */
+	"c-wsp"  /* 131 */
+	"c-wsp"  /* 136 */
+	"WSP"  /* 141 */
+	"c-nl"  /* 144 */
+	"WSP"  /* 148 */
+	"c-nl"  /* 151 */
+	"comment"  /* 155 */
+	"CRLF"  /* 162 */
+	"comment"  /* 166 */
+	"WSP"  /* 173 */
+	"VCHAR"  /* 176 */
+	"CRLF"  /* 181 */
+	"alternation"  /* 185 */
+	"concatenation"  /* 196 */
+	"c-wsp"  /* 209 */
+	"c-wsp"  /* 214 */
+	"concatenation"  /* 219 */
+	"concatenation"  /* 232 */
+	"repetition"  /* 245 */
+	"c-wsp"  /* 255 */
+	"repetition"  /* 260 */
+	"repetition"  /* 270 */
+	"repeat"  /* 280 */
+	"element"  /* 286 */
+	"repeat"  /* 293 */
+	"DIGIT"  /* 299 */
+	"DIGIT"  /* 304 */
+	"DIGIT"  /* 309 */
+	"element"  /* 314 */
+	"rulename"  /* 321 */
+	"group"  /* 329 */
+	"option"  /* 334 */
+	"char-val"  /* 340 */
+	"num-val"  /* 348 */
+	"prose-val"  /* 355 */
+	"group"  /* 364 */
+	"c-wsp"  /* 369 */
+	"alternation"  /* 374 */
+	"c-wsp"  /* 385 */
+	"option"  /* 390 */
+	"c-wsp"  /* 396 */
+	"alternation"  /* 401 */
+	"c-wsp"  /* 412 */
+	"char-val"  /* 417 */
+	"DQUOTE"  /* 425 */
+	"DQUOTE"  /* 431 */
+	"num-val"  /* 437 */
+	"bin-val"  /* 444 */
+	"dec-val"  /* 451 */
+	"hex-val"  /* 458 */
+	"bin-val"  /* 465 */
+	"b"  /* 472 */
+	"BIT"  /* 473 */
+	"BIT"  /* 476 */
+	"BIT"  /* 479 */
+	"dec-val"  /* 482 */
+	"d"  /* 489 */
+	"DIGIT"  /* 490 */
+	"DIGIT"  /* 495 */
+	"DIGIT"  /* 500 */
+	"hex-val"  /* 505 */
+	"x"  /* 512 */
+	"HEXDIG"  /* 513 */
+	"HEXDIG"  /* 519 */
+	"HEXDIG"  /* 525 */
+	"prose-val"  /* 531 */
+	;
+
+static const struct abnf_bin_tables abnf_tables = {
+	.rules = abnf_rules,
+	.alternations = abnf_alternations,
+	.concatenations = abnf_concatenations,
+	.index = abnf_index,
+	.strings = abnf_strings,
+	.rule_count = 21,
+	.alternation_count = 56,
+	.concatenation_count = 101,
+	.index_size = 32,
+	.string_size = 540,
+};
+
+int abnf_declare_abnf_rules(struct abnf_grammar *g) {
+	return abnf_load_bin_tables(g, &abnf_tables, abnf_mk_str(NULL), 1);
+}
@@ -25,6 +25,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <signal.h>
 
 struct abnf_str {
 	char *s;
@@ -83,20 +86,78 @@ struct abnf_alternation {
 
 };
 
+#define ABNF_INTERNAL_INCREMENTAL 0x10  /* rule was introduced by "=/" */
+#define ABNF_INTERNAL_START       0x80  /* rule was selected by abnf_select_rules */
+
 struct abnf_rule {
 	struct abnf_str name;
 	struct abnf_alternation *alternation;
 	struct abnf_str origin;
 	struct {  /* private fields */
 		unsigned int flags;
+		unsigned int hash;
+		struct abnf_rule *hash_next;
+		unsigned int index, lowlink, order;  /* dependency resolution */
+		struct abnf_alternation *last_alternation;  /* member of alternation list or NULL, see abnf_rule_last_alternation */
 	} internal;
 	struct abnf_rule *prev, *next;
 };
 
+/* library context, e.g. one per thread, fields left NULL take defaults, grammars
+ * using the same context may be merged */
+struct abnf_context {
+	void* (*alloc)(size_t size);  /* grammar memory, i.e. pool blocks and rule index, default malloc */
+	void (*release)(void *p);  /* default free */
+	FILE *diag;  /* diagnostics of parsers and grammar checks, default stderr */
+	volatile sig_atomic_t *cancel;  /* parser stops when non zero, default abnf_stop_flag */
+};
+
+#define abnf_ctx_alloc(_ctx_, _size_) (((_ctx_) && (_ctx_)->alloc)?(_ctx_)->alloc(_size_):abnf_malloc(_size_))
+#define abnf_ctx_release(_ctx_, _p_) (((_ctx_) && (_ctx_)->release)?(_ctx_)->release(_p_):abnf_free(_p_))
+#define abnf_ctx_diag(_ctx_) (((_ctx_) && (_ctx_)->diag)?(_ctx_)->diag:stderr)
+#define abnf_ctx_cancelled(_ctx_) (((_ctx_) && (_ctx_)->cancel)?*(_ctx_)->cancel:abnf_stop_flag)
+
+/* region allocator, items are bump allocated in large blocks and released all at once */
+#define ABNF_POOL_BLOCK_SIZE 65536
+#define ABNF_POOL_ALIGN 16
+
+struct abnf_pool_block {
+	struct abnf_pool_block *next;
+	size_t size, used;
+};
+
+struct abnf_pool {
+	struct abnf_pool_block *block;
+	struct abnf_context *ctx;
+};
+
+/* input buffer kept alive for grammar lifetime, rule names and literals point into it */
+struct abnf_buffer {
+	char *s;
+	size_t len;
+	int mapped;
+	struct abnf_buffer *next;
+};
+
+/* rule list and memory holding its nodes, strings etc. */
+struct abnf_grammar {
+	struct abnf_context *ctx;
+	struct abnf_rule *rules;
+	struct abnf_rule *last_rule;  /* member of rules or NULL, see abnf_grammar_last_rule */
+	struct abnf_pool pool;
+	enum {ABNF_GRAMMAR_ZERO_COPY=0x01} flags;
+	struct abnf_buffer *buffers;
+	struct abnf_rule **index;  /* case insensitive hash of rule names, chained via internal.hash_next */
+	unsigned int index_size, index_count;
+};
+
 struct abnf_print_info {
 	unsigned int in_file_count;
 	struct abnf_str *in_files;
 	struct abnf_str out_file;
+	enum {ABNF_PRINT_NO_DATE=0x01} flags;
+	time_t date;  /* printed as UTC if not zero, e.g. SOURCE_DATE_EPOCH, otherwise current local time */
+	struct abnf_str main_rule;  /* rule instantiated as Ragel main, the last rule if empty */
 };
 
 struct abnf_print_comment {
@@ -109,6 +170,33 @@ struct abnf_print_comment {
  */
 extern void abnf_print_header(FILE *stream, struct abnf_print_info *info, struct abnf_print_comment *comment);
 
+/* output buffer of printers, stream gets data in large blocks */
+#define ABNF_WRITER_SIZE 65536
+
+struct abnf_writer {
+	FILE *stream;
+	size_t len;
+	int err;
+	char buff[ABNF_WRITER_SIZE];
+};
+
+extern void abnf_writer_init(struct abnf_writer *w, FILE *stream);
+/** writes buffered data to stream, returns -1 if any write failed since init */
+extern int abnf_writer_flush(struct abnf_writer *w);
+extern void abnf_write(struct abnf_writer *w, const char *s, size_t len);
+extern void abnf_write_cstr(struct abnf_writer *w, const char *s);
+extern void abnf_write_rep_char(struct abnf_writer *w, char c, int n);
+/** two lower case hex digits */
+extern void abnf_write_hex(struct abnf_writer *w, unsigned char c);
+extern void abnf_write_uint(struct abnf_writer *w, unsigned int n);
+extern void abnf_writef(struct abnf_writer *w, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+#define abnf_write_char(_w_, _c_) \
+	do { \
+		if ((_w_)->len >= ABNF_WRITER_SIZE) abnf_writer_flush(_w_); \
+		(_w_)->buff[(_w_)->len++] = (_c_); \
+	} while (0)
+#define abnf_write_str(_w_, _s_) abnf_write((_w_), (_s_).s, (_s_).len)
+
 struct abnf_str abnf_mk_str(char *s);
 struct abnf_str abnf_dupl_str(struct abnf_str s);
 void abnf_destroy_str(struct abnf_str *s);
@@ -120,6 +208,48 @@ int abnf_concatenation_count(struct abnf_concatenation *p);
 #define abnf_free(_p_) free(_p_)
 #define abnf_realloc(_p_, _size_) realloc((_p_), (_size_))
 
+/** if pool is NULL then abnf_malloc is used and item must be freed explicitly */
+extern void* abnf_pool_alloc(struct abnf_pool *pool, size_t size);
+extern struct abnf_str abnf_pool_dupl_str(struct abnf_pool *pool, struct abnf_str s);
+extern void abnf_init_pool(struct abnf_pool *pool);
+extern void abnf_init_pool_ctx(struct abnf_pool *pool, struct abnf_context *ctx);
+extern void abnf_destroy_pool(struct abnf_pool *pool);
+/** moves all blocks of src pool to dst pool */
+extern void abnf_pool_adopt(struct abnf_pool *dst, struct abnf_pool *src);
+
+extern void abnf_init_grammar(struct abnf_grammar *g);
+/** context must outlive grammar, NULL means defaults */
+extern void abnf_init_grammar_ctx(struct abnf_grammar *g, struct abnf_context *ctx);
+/** releases all rules allocated in grammar pool and input buffers */
+extern void abnf_destroy_grammar(struct abnf_grammar *g);
+/** reads whole stream, regular file is mapped read only */
+extern int abnf_read_stream(FILE *in_stream, struct abnf_buffer *pb);
+/** maps regular file, pb->mapped is zero if stream cannot be mapped and must be read */
+extern int abnf_map_stream(FILE *in_stream, struct abnf_buffer *pb);
+extern void abnf_release_buffer(struct abnf_buffer *pb);
+/** buffer will be freed or unmapped when grammar is destroyed */
+extern int abnf_grammar_keep_buffer(struct abnf_grammar *g, char *s, size_t len, int mapped);
+/** append rule chain to grammar rule list and index it */
+extern int abnf_grammar_append_rules(struct abnf_grammar *g, struct abnf_rule *rules);
+/** rule index must be kept in sync with g->rules when a rule is added or removed */
+extern int abnf_grammar_index_rule(struct abnf_grammar *g, struct abnf_rule *pr);
+extern void abnf_grammar_unindex_rule(struct abnf_grammar *g, struct abnf_rule *pr);
+/** unindex and unlink rule, rule memory stays in pool */
+extern void abnf_grammar_remove_rule(struct abnf_grammar *g, struct abnf_rule *pr);
+/** tails are cached, walking starts at cached member so they survive reordering and appends,
+ *  code removing rules or alternations must not leave removed item cached */
+extern struct abnf_rule* abnf_grammar_last_rule(struct abnf_grammar *g);
+extern struct abnf_alternation* abnf_rule_last_alternation(struct abnf_rule *pr);
+extern void abnf_rule_append_alternations(struct abnf_rule *pr, struct abnf_alternation *pa);
+/** case insensitive hash used by rule index */
+extern unsigned int abnf_hash_name(struct abnf_str name);
+/** hash lookup, returns first indexed rule of given name */
+extern struct abnf_rule* abnf_grammar_find_rule(struct abnf_grammar *g, struct abnf_str name);
+/** moves rules of src to g as if src was parsed after g, i.e. "=" rule overrides rule in g and
+ *  "=/" rule extends it, src memory is taken over by g and src is left empty, grammars
+ *  must use the same allocator */
+extern int abnf_grammar_merge(struct abnf_grammar *g, struct abnf_grammar *src);
+
 extern struct abnf_rule* abnf_find_rule(struct abnf_rule* rules, struct abnf_str name);
 
 /* struct abnf_repetition related stuff */
@@ -133,9 +263,9 @@ extern struct abnf_rule* abnf_find_rule(struct abnf_rule* rules, struct abnf_str
 #define ABNF_IS_DIGIT(_c_) ( ((_c_)>='0' && (_c_)<='9') )
 #define ABNF_IS_VALID_TOKEN_CHAR(_c_) ( ((_c_)>=0x20 && (_c_)<=0x21) || ((_c_)>=0x23 && (_c_)<=0x7e) )
 
-extern struct abnf_rule* abnf_add_rule(struct abnf_str name, struct abnf_alternation* alternation, struct abnf_rule* next);
-extern struct abnf_alternation* abnf_add_alternation(struct abnf_concatenation *concatenation, struct abnf_alternation *next);
-extern struct abnf_concatenation* abnf_add_concatenation(struct abnf_repetition repetition, struct abnf_concatenation *next);
+extern struct abnf_rule* abnf_add_rule(struct abnf_pool *pool, struct abnf_str name, struct abnf_alternation* alternation, struct abnf_rule* next);
+extern struct abnf_alternation* abnf_add_alternation(struct abnf_pool *pool, struct abnf_concatenation *concatenation, struct abnf_alternation *next);
+extern struct abnf_concatenation* abnf_add_concatenation(struct abnf_pool *pool, struct abnf_repetition repetition, struct abnf_concatenation *next);
 extern struct abnf_repetition abnf_mk_repetition(struct abnf_element element, unsigned int min, unsigned int max);
 #define abnf_mk_optional(_element_) abnf_mk_repetition((_element_), 0, 1)
 #define abnf_mk_once(_element_) abnf_mk_repetition((_element_), 1, 1)
@@ -153,6 +283,7 @@ extern struct abnf_element abnf_mk_element_action(abnf_action_t action, void* us
 /** assign origin for rules chain up to rules_end (excluded), if rules_end is null then assign to all rules */
 extern void abnf_rule_assign_origin(struct abnf_rule* rules, struct abnf_rule* rules_end, struct abnf_str origin);
 
+/** destroys rules created without pool */
 extern void abnf_destroy_rules(struct abnf_rule* rules);
 extern void abnf_destroy_alternations(struct abnf_alternation* alternation);
 extern void abnf_destroy_concatenations(struct abnf_concatenation* concatenation);
@@ -169,22 +300,141 @@ extern void abnf_destroy_element(struct abnf_element* e);
 	} \
 	(_p_)->prev = (_p_)->next = NULL;
 
-extern struct abnf_rule* abnf_declare_core_rules(struct abnf_rule* next);   /* RFC2234 Core rules */
-extern struct abnf_rule* abnf_declare_abnf_rules(struct abnf_rule* next);   /* RFC2234 ABNF definition of ABNF */
+/* rules are appended to grammar, names and literals point to static data */
+extern int abnf_declare_core_rules(struct abnf_grammar *g);   /* RFC2234 Core rules */
+extern int abnf_declare_abnf_rules(struct abnf_grammar *g);   /* RFC2234 ABNF definition of ABNF */
 
+/** orders rules so that rule follows all rules it depends on, each group of mutually
+ *  recursive rules is reported to stream, returns -1 if any such group exists */
 extern int abnf_resolve_rule_dependencies(FILE *stream, struct abnf_rule **rules);
-extern int abnf_check_rules(FILE *stream, struct abnf_rule *rules);
+extern int abnf_check_rules(struct abnf_grammar *g);
+/** removes rules not reachable from start rules, start rules are marked ABNF_INTERNAL_START,
+ *  returns number of removed rules or -1 if a start rule is not found */
+extern int abnf_select_rules(struct abnf_grammar *g, struct abnf_str *start, unsigned int start_count);
+
+/* code located in optimize.c */
+/** set of bytes, bit n of bits[n/32] is set if byte n is member */
+struct abnf_char_set {
+	uint32_t bits[8];
+};
+
+#define ABNF_CHAR_SET_ADD(_cs_, _c_) ((_cs_).bits[(unsigned char)(_c_)>>5] |= (uint32_t)1 << ((unsigned char)(_c_)&31))
+#define ABNF_CHAR_SET_DEL(_cs_, _c_) ((_cs_).bits[(unsigned char)(_c_)>>5] &= ~((uint32_t)1 << ((unsigned char)(_c_)&31)))
+#define ABNF_CHAR_SET_HAS(_cs_, _c_) (((_cs_).bits[(unsigned char)(_c_)>>5] >> ((unsigned char)(_c_)&31)) & 1)
+
+/** returns 1 and fills set if each alternative matches exactly one byte, i.e. it's a range, one character
+ *  literal or group or resolved rule of such alternatives, returns 0 otherwise */
+extern int abnf_char_class(struct abnf_alternation *pa, struct abnf_char_set *cs);
+
+struct abnf_optimize_size {
+	unsigned int rules, alternations, concatenations;
+};
+
+struct abnf_optimize_info {
+	struct abnf_optimize_size before, after;
+	unsigned int inlined;  /* rules merged into single referencing rule */
+	unsigned int classes;  /* alternations folded to minimal range list */
+};
+
+/** rewrites checked grammar to equivalent smaller one, flattens nested groups, inlines rules referenced
+ *  only once (except last rule and start rules), combines nested repetitions, removes duplicate alternatives and folds
+ *  alternatives matching one byte to minimal list of ranges */
+extern int abnf_optimize_rules(struct abnf_grammar *g, struct abnf_optimize_info *info);
+
+/* code located in analyze.c */
+/** computes nullable, FIRST and FOLLOW byte sets of rules and reports to context diagnostics alternatives
+ *  starting with the same byte and repetitions whose body may start with byte following them,
+ *  returns number of warnings or -1 on error */
+extern int abnf_analyze_rules(struct abnf_grammar *g);
+/** estimates number of states Ragel builds for each rule with referenced rules expanded and bounded
+ *  repetitions unrolled, reference within recursive rule group counts as one state, lists top largest rules and all rules over max_states (if not zero) to context diagnostics,
+ *  returns number of rules over limit or -1 on error */
+extern int abnf_estimate_states(struct abnf_grammar *g, unsigned long long max_states, unsigned int top);
+
+/* binary rule list format, native byte order, nodes are referenced by index+1, 0 is NULL,
+ * header is followed by rule, alternation and concatenation tables, rule name hash buckets
+ * and string pool */
+#define ABNF_BIN_MAGIC "ABNFCBIN"
+#define ABNF_BIN_FORMAT 2
+#define ABNF_BIN_BOM 0x01020304
+
+struct abnf_bin_header {
+	char magic[8];
+	uint32_t format;
+	uint32_t bom;
+	char version[16];  /* abnfc version which wrote it */
+	uint32_t rule_count;
+	uint32_t alternation_count;
+	uint32_t concatenation_count;
+	uint32_t index_size;  /* power of 2, rule name hash buckets */
+	uint32_t string_size;
+};
+
+struct abnf_bin_rule {
+	uint32_t name, name_len;  /* offset in string pool */
+	uint32_t origin, origin_len;
+	uint32_t alternation;
+	uint32_t flags;
+	uint32_t hash;  /* abnf_hash_name */
+	uint32_t hash_next;  /* next rule in bucket */
+};
+
+struct abnf_bin_alternation {
+	uint32_t concatenation;
+	uint32_t next;
+};
+
+struct abnf_bin_concatenation {
+	uint32_t min, max;
+	uint32_t type;
+	uint32_t a, b;  /* string: offset and length, range: lo and hi, group: alternation */
+	uint32_t next;
+};
+
+/* binary rule list tables, either parts of mapped binary file or static data generated by abnf_print_self_rules */
+struct abnf_bin_tables {
+	const struct abnf_bin_rule *rules;
+	const struct abnf_bin_alternation *alternations;
+	const struct abnf_bin_concatenation *concatenations;
+	const uint32_t *index;
+	const char *strings;
+	uint32_t rule_count;
+	uint32_t alternation_count;
+	uint32_t concatenation_count;
+	uint32_t index_size;
+	uint32_t string_size;
+};
+
+/** builds tables of rule list, tables are allocated using abnf_malloc */
+extern int abnf_build_bin_tables(struct abnf_rule *rules, struct abnf_bin_tables *t);
+extern void abnf_free_bin_tables(struct abnf_bin_tables *t);
+/** appends rules from tables to grammar, if static_strings then strings are never copied because they
+ *  outlive grammar, if origin non empty then it replaces stored origin */
+extern int abnf_load_bin_tables(struct abnf_grammar *g, const struct abnf_bin_tables *t, struct abnf_str origin, int static_strings);
 
 /* code located in print_*.c */
 extern void abnf_print_abnf_rules(FILE *stream, struct abnf_rule *rules, struct abnf_print_info *info);
 extern void abnf_print_ragel_rules(FILE *stream, struct abnf_rule *rules, struct abnf_print_info *info, char* machine_name, int instantiate);
-extern void abnf_print_self_rules(FILE *stream, struct abnf_rule *rules, struct abnf_print_info *info);
+/** prints C source declaring function abnf_declare_<name>_rules(grammar) */
+extern int abnf_print_self_rules(FILE *stream, struct abnf_rule *rules, struct abnf_print_info *info, char *name);
+extern int abnf_print_bin_rules(FILE *stream, struct abnf_rule *rules, struct abnf_print_info *info);
 
 /* code located in parse_*.c */
-/** if origin non empty then string will be duplicated for each rule */
-extern int abnf_parse_abnf(FILE* in_stream, struct abnf_rule **rules, struct abnf_str origin);
-
-extern int abnf_stop_flag;
+/** rules are appended to grammar and allocated in its pool, if origin non empty then string is duplicated to pool,
+ *  in ABNF_GRAMMAR_ZERO_COPY mode names and literals point to input buffer which is kept by grammar,
+ *  streams which cannot be mapped (pipes) are parsed in chunks and strings are always copied,
+ *  returns -1 on fatal error, 1 if input was not parsed completely */
+extern int abnf_parse_abnf(FILE* in_stream, struct abnf_grammar *grammar, struct abnf_str origin);
+/** as abnf_parse_abnf when in_buff was filled by abnf_map_stream(in_stream), in_buff is taken over */
+extern int abnf_parse_abnf_mapped(FILE* in_stream, struct abnf_buffer *in_buff, struct abnf_grammar *grammar, struct abnf_str origin);
+/** loads rules written by abnf_print_bin_rules and merges them to grammar, if origin
+ *  non empty then it replaces stored origin, returns -1 if data are not valid */
+extern int abnf_parse_bin(FILE* in_stream, struct abnf_grammar *grammar, struct abnf_str origin);
+/** as abnf_parse_bin from buffer, trailing data after rule list are ignored, in_buff is taken over */
+extern int abnf_parse_bin_buffer(struct abnf_buffer *in_buff, struct abnf_grammar *grammar, struct abnf_str origin);
+
+/** default cancel token, abnfc sets it from signal handler */
+extern volatile sig_atomic_t abnf_stop_flag;
 
 #endif
 
@@ -34,8 +34,18 @@
 #include <getopt.h>
 #include <signal.h>
 #include <string.h>
+#include <pthread.h>
+#include <limits.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <poll.h>
 
 static int verbose = 0;
+static char *cache_dir = NULL;
 
 static void print_version() {
 	printf("%s", NAME_S" - ABNF compiler, v"VERSION_S"\n");
@@ -49,17 +59,37 @@ static void print_help(char *name) {
 	printf("  'abnf': rfc2234 ABNF rules\n");
 	printf("  '-':    forces reading from stdin\n");
 	printf("\n");
-	printf("  -f format   format of output\n");
+	printf("  -f format   format of output, several -f/-o pairs may be given\n");
 	printf("              'abnf':  print ABNF rules\n");
 	printf("              'ragel': print Ragel rules (default)\n");
 	printf("              'self':  print abnfc C rules\n");
+	printf("              'bin':   print binary rule list\n");
 	printf("  -o file     output file name, default: stdout\n");
 	printf("  -t in_type  type of next input file\n");
 	printf("              'file': load rules from file\n");
 	printf("              'self': load internal rules (default)\n");
+	printf("              'bin':  load binary rule list from file\n");
 	printf("  -n name     name of the machine if format is 'ragel'\n");
 	printf("              the default is 'generated_from_abnf'\n");
+	printf("              or part of function name abnf_declare_<name>_rules if format\n");
+	printf("              is 'self', the default is 'custom'\n");
 	printf("  -i          do not generate main rule if format is 'ragel'\n");
+	printf("  -r rules    comma separated start rules, only rules reachable from them\n");
+	printf("              are printed, the first one is Ragel main, may be repeated\n");
+	printf("  -a          warn about alternatives and repetitions which are not decidable\n");
+	printf("              by the next input byte\n");
+	printf("  -S states   list rules with largest estimated number of Ragel states and fail\n");
+	printf("              if a rule exceeds given number, 0 means no limit\n");
+	printf("  -O          optimize rules before printing, report size reduction to stderr\n");
+	printf("  -R          do not print generation date, SOURCE_DATE_EPOCH fixes it\n");
+	printf("  -u          replace output file only if content differs\n");
+	printf("  -MD         write make dependencies of output files to <output>.d\n");
+	printf("  -MF file    write make dependencies to file\n");
+	printf("  -MP         add phony target for each input file\n");
+	printf("  -j jobs     number of threads parsing input files, default: number of CPUs\n");
+	printf("  -C dir      cache parsed input files in directory\n");
+	printf("  -D socket   run as compile server listening on Unix domain socket\n");
+	printf("  -c socket   let compile server process the command line\n");
 	printf("\n");
 	printf("Common options:\n");
 	printf("  -F          print output even an ABNF rule error is detected\n");
@@ -73,8 +103,6 @@ static void print_help(char *name) {
 	printf("\n");
 }
 
-int abnf_stop_flag = 0;
-
 static void sig_term(int signr) {
     abnf_stop_flag++;
 	fprintf(stderr, "Signal (%d) detected\n", signr);
@@ -88,36 +116,1024 @@ static void sig_term(int signr) {
 		exit (-1);\
 }
 
-int main(int argc, char** argv) {
+static int is_stdin(struct abnf_str name) {
+	return !name.len || strcmp(name.s, "-") == 0;  /* it's null terminated */
+}
+
+static int is_internal_list(struct abnf_str name) {
+	return strcasecmp("core", name.s) == 0 || strcasecmp("abnf", name.s) == 0;
+}
+
+/* content hash locating cached rules, FNV-1a, hits are verified against stored source */
+static unsigned long long hash_buffer(const char *s, size_t len) {
+	unsigned long long h;
+	size_t i;
+	for (i=0, h=14695981039346656037ULL; i<len; i++) {
+		h ^= (unsigned char) s[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/* parsed rules are cached in binary format, file name is derived from content and abnfc version */
+static int cache_file_name(unsigned long long hash, size_t len, char *buff, size_t size) {
+	if (snprintf(buff, size, "%s/%016llx-%llx-%s-%u.abnfc", cache_dir, hash, (unsigned long long) len, VERSION_S, ABNF_BIN_FORMAT) >= size)
+		return -1;
+	return 0;
+}
+
+/* cache file holds binary rules followed by source they were parsed from */
+static void cache_store(char *cache_file, struct abnf_grammar *grammar, const char *source, size_t len) {
+	char tmp_file[PATH_MAX];
+	FILE *stream;
+	int fd, ret;
+	if (snprintf(tmp_file, sizeof(tmp_file), "%s/.tmp-XXXXXX", cache_dir) >= sizeof(tmp_file)) return;
+	fd = mkstemp(tmp_file);
+	if (fd < 0) return;
+	stream = fdopen(fd, "w");
+	if (!stream) {
+		close(fd);
+		unlink(tmp_file);
+		return;
+	}
+	ret = abnf_print_bin_rules(stream, grammar->rules, NULL);
+	if (ret == 0 && fwrite(source, 1, len, stream) != len) ret = -1;
+	if (fclose(stream) != 0 || ret < 0 || rename(tmp_file, cache_file) < 0) {
+		unlink(tmp_file);
+	}
+}
+
+static int cache_load(char *cache_file, const char *source, size_t len, struct abnf_str name, struct abnf_grammar *grammar) {
+	struct abnf_buffer cache_buff;
+	FILE *stream;
+	stream = fopen(cache_file, "r");
+	if (!stream) return -1;
+	abnf_map_stream(stream, &cache_buff);
+	fclose(stream);
+	if (!cache_buff.mapped) return -1;
+	/* hash collision or entry of other layout */
+	if (cache_buff.len < len || memcmp(cache_buff.s + cache_buff.len - len, source, len) != 0) {
+		abnf_release_buffer(&cache_buff);
+		return -1;
+	}
+	return abnf_parse_bin_buffer(&cache_buff, grammar, name);
+}
+
+/* compile server keeps rules of recently parsed files in memory as binary tables,
+ * tables are released between requests only because loaded rules reference their strings
+ */
+#ifndef MAX_RESIDENT_FILES
+#define MAX_RESIDENT_FILES 256
+#endif
+
+struct resident_file {
+	unsigned long long hash;
+	char *source;
+	size_t len;
+	unsigned long last_used;
+	struct abnf_bin_tables tables;
+};
+
+static struct {
+	pthread_mutex_t mutex;
+	struct resident_file *files;  /* NULL if not running as server */
+	int count;
+	unsigned long request;
+} resident = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static struct resident_file* resident_find(unsigned long long hash, const char *source, size_t len) {
+	int i;
+	for (i=0; i<resident.count; i++) {
+		if (resident.files[i].hash == hash && resident.files[i].len == len &&
+			memcmp(resident.files[i].source, source, len) == 0)
+			return &resident.files[i];
+	}
+	return NULL;
+}
+
+static int resident_load(unsigned long long hash, const char *source, size_t len, struct abnf_str name, struct abnf_grammar *grammar) {
+	struct resident_file *f;
+	struct abnf_grammar g;
+	int ret;
+	if (!resident.files) return -1;
+	pthread_mutex_lock(&resident.mutex);
+	f = resident_find(hash, source, len);
+	if (f) f->last_used = resident.request;
+	pthread_mutex_unlock(&resident.mutex);
+	if (!f) return -1;
+	abnf_init_grammar(&g);
+	g.flags = grammar->flags;
+	ret = abnf_load_bin_tables(&g, &f->tables, name, 1);
+	if (ret == 0) {
+		ret = abnf_grammar_merge(grammar, &g);
+	}
+	abnf_destroy_grammar(&g);
+	return ret;
+}
+
+/* source is taken over */
+static void resident_store(unsigned long long hash, char *source, size_t len, struct abnf_grammar *grammar) {
+	struct abnf_bin_tables t;
+	struct resident_file *f;
+	if (!resident.files || abnf_build_bin_tables(grammar->rules, &t) < 0) {
+		abnf_free(source);
+		return;
+	}
+	pthread_mutex_lock(&resident.mutex);
+	if (resident.count < MAX_RESIDENT_FILES && !resident_find(hash, source, len)) {
+		f = &resident.files[resident.count];
+		f->hash = hash;
+		f->source = source;
+		f->len = len;
+		f->last_used = resident.request;
+		f->tables = t;
+		resident.count++;
+		t.rules = NULL;
+		source = NULL;
+	}
+	pthread_mutex_unlock(&resident.mutex);
+	if (t.rules) abnf_free_bin_tables(&t);
+	if (source) abnf_free(source);
+}
+
+static int resident_cmp(const void *a, const void *b) {
+	unsigned long ua = ((const struct resident_file *) a)->last_used, ub = ((const struct resident_file *) b)->last_used;
+	return ua > ub ? -1 : ua < ub;
+}
+
+/* drop least recently used files */
+static void resident_trim(int keep) {
+	int i;
+	if (resident.count <= keep) return;
+	qsort(resident.files, resident.count, sizeof(*resident.files), resident_cmp);
+	for (i=keep; i<resident.count; i++) {
+		abnf_free_bin_tables(&resident.files[i].tables);
+		abnf_free(resident.files[i].source);
+	}
+	resident.count = keep;
+}
+
+static int parse_file(struct abnf_str name, struct abnf_grammar *grammar) {
+	FILE *in_stream, *diag_stream;
+	char cache_file[PATH_MAX], *source = NULL, *diag = NULL;
+	size_t len, diag_len = 0;
+	struct abnf_buffer in_buff;
+	struct abnf_context ctx;
+	struct abnf_grammar file_grammar;
+	unsigned long long hash;
+	int ret, cache_fl;
+	in_stream = fopen(name.s, "r");  /* it's null terminated */
+	if (!in_stream) {
+		fprintf(stderr, "ERROR: %s: %s (errno:%d)\n", name.s, strerror(errno), errno);
+		return -1;
+	}
+	/* file is mapped once for hashing and parsing */
+	abnf_map_stream(in_stream, &in_buff);
+	if ((!cache_dir && !resident.files) || !in_buff.mapped) {
+		ret = abnf_parse_abnf_mapped(in_stream, &in_buff, grammar, name);
+		fclose(in_stream);
+		return ret;
+	}
+	len = in_buff.len;
+	hash = hash_buffer(in_buff.s, len);
+	if (resident_load(hash, in_buff.s, len, name, grammar) == 0) {
+		abnf_release_buffer(&in_buff);
+		fclose(in_stream);
+		return 0;
+	}
+	cache_fl = cache_dir && cache_file_name(hash, len, cache_file, sizeof(cache_file)) == 0;
+	if (cache_fl && !resident.files && cache_load(cache_file, in_buff.s, len, name, grammar) == 0) {
+		abnf_release_buffer(&in_buff);
+		fclose(in_stream);
+		return 0;
+	}
+	/* file is parsed alone and merged so the caches keep its rules only, parser
+	 * diagnostics are captured because hit would not repeat them, such file is not cached */
+	memset(&ctx, 0, sizeof(ctx));
+	abnf_init_grammar_ctx(&file_grammar, &ctx);
+	file_grammar.flags = grammar->flags;
+	source = abnf_malloc(len);
+	if (source) memcpy(source, in_buff.s, len);
+	ret = -1;
+	if (cache_fl && resident.files) {
+		ret = cache_load(cache_file, in_buff.s, len, name, &file_grammar);
+	}
+	if (ret < 0) {
+		diag_stream = open_memstream(&diag, &diag_len);
+		ctx.diag = diag_stream;
+		ret = abnf_parse_abnf_mapped(in_stream, &in_buff, &file_grammar, name);
+		ctx.diag = NULL;
+		if (diag_stream) {
+			fclose(diag_stream);
+			if (diag_len) fwrite(diag, 1, diag_len, stderr);
+			free(diag);
+		}
+		if (ret == 0 && cache_fl && source && !diag_len) {
+			cache_store(cache_file, &file_grammar, source, len);
+		}
+	}
+	else {
+		abnf_release_buffer(&in_buff);
+	}
+	fclose(in_stream);
+	if (ret == 0 && source && !diag_len) {
+		resident_store(hash, source, len, &file_grammar);
+	}
+	else if (source) {
+		abnf_free(source);
+	}
+	if (ret >= 0 && abnf_grammar_merge(grammar, &file_grammar) < 0) {
+		ret = -1;
+	}
+	abnf_destroy_grammar(&file_grammar);
+	return ret;
+}
+
+/* input files are parsed concurrently to separate grammars and merged in command line order */
+struct parse_job {
+	struct abnf_str name;
+	struct abnf_grammar grammar;
+	int queued;
+	int status;
+};
+
+static struct {
+	pthread_mutex_t mutex;
+	struct parse_job *jobs;
+	int count, next;
+} job_queue = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static void* parse_worker(void *arg) {
+	struct parse_job *job;
+	while (!abnf_stop_flag) {
+		pthread_mutex_lock(&job_queue.mutex);
+		for (; job_queue.next < job_queue.count && !job_queue.jobs[job_queue.next].queued; job_queue.next++);
+		job = job_queue.next < job_queue.count ? &job_queue.jobs[job_queue.next++] : NULL;
+		pthread_mutex_unlock(&job_queue.mutex);
+		if (!job) break;
+		job->status = parse_file(job->name, &job->grammar);
+	}
+	return NULL;
+}
+
+static int parse_files_concurrently(struct parse_job *jobs, int count, int thread_count) {
+	pthread_t *threads;
+	int i, n;
+	for (i=0, n=0; i<count; i++) {
+		if (jobs[i].queued) n++;
+	}
+	if (thread_count > n) thread_count = n;
+	if (thread_count <= 1) return 0;
+	threads = abnf_malloc(sizeof(*threads)*thread_count);
+	if (!threads) return -1;
+	job_queue.jobs = jobs;
+	job_queue.count = count;
+	job_queue.next = 0;
+	for (n=0; n<thread_count; n++) {
+		if (pthread_create(&threads[n], NULL, parse_worker, NULL) != 0)
+			break;
+	}
+	if (n == 0) {
+		abnf_free(threads);
+		return -1;
+	}
+	for (i=0; i<n; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	abnf_free(threads);
+	return 0;
+}
+
+static void destroy_jobs(struct parse_job *jobs, int count) {
+	int i;
+	if (!jobs) return;
+	for (i=0; i<count; i++) {
+		if (jobs[i].queued) abnf_destroy_grammar(&jobs[i].grammar);
+	}
+	abnf_free(jobs);
+}
+
+/* input file list grows on demand up to hard limit */
+#ifndef MAX_IN_FILES
+#define MAX_IN_FILES 65536
+#endif
+
+enum in_fmt {if_File, if_Internal, if_Bin};
+
+static int add_in_file(struct abnf_str **files, enum in_fmt **flags, int *count, int *size, struct abnf_str name, enum in_fmt flag) {
+	struct abnf_str *f;
+	enum in_fmt *fl;
+	int n;
+	if (*count >= *size) {
+		if (*size >= MAX_IN_FILES) {
+			fprintf(stderr, "ERROR: too many input files, max. %d\n", MAX_IN_FILES);
+			return -1;
+		}
+		n = *size ? *size * 2 : 16;
+		if (n > MAX_IN_FILES) n = MAX_IN_FILES;
+		f = abnf_realloc(*files, sizeof(**files)*n);
+		if (!f) goto err;
+		*files = f;
+		fl = abnf_realloc(*flags, sizeof(**flags)*n);
+		if (!fl) goto err;
+		*flags = fl;
+		*size = n;
+	}
+	(*files)[*count] = name;
+	(*flags)[*count] = flag;
+	(*count)++;
+	return 0;
+err:
+	fprintf(stderr, "ERROR: not enough memory for input file list\n");
+	return -1;
+}
+
+/* -r takes comma separated rule names, names point to command line */
+static int add_start_rules(struct abnf_str **rules, int *count, int *size, char *names) {
+	struct abnf_str *r;
+	char *p;
+	int n;
+	while (*names) {
+		for (p = names; *p && *p != ','; p++);
+		if (p > names) {
+			if (*count >= *size) {
+				n = *size ? *size * 2 : 16;
+				r = abnf_realloc(*rules, sizeof(**rules)*n);
+				if (!r) {
+					fprintf(stderr, "ERROR: not enough memory for start rule list\n");
+					return -1;
+				}
+				*rules = r;
+				*size = n;
+			}
+			(*rules)[*count].s = names;
+			(*rules)[*count].len = p - names;
+			(*rules)[*count].flags = 0;
+			(*count)++;
+		}
+		names = *p ? p+1 : p;
+	}
+	return 0;
+}
+
+/* several outputs may be printed from one rule list, -f and -o fill in last output
+ * and repeated one starts next output
+ */
+#ifndef MAX_OUTPUTS
+#define MAX_OUTPUTS 16
+#endif
+#ifndef MAX_LISTED_RULES
+#define MAX_LISTED_RULES 10  /* largest rules listed by -S */
+#endif
+
+enum out_fmt {of_Default, of_Ragel, of_Abnf, of_Self, of_Bin};
 
-	#define MAX_IN_FILES 50
-
-	enum {of_Default, of_Ragel, of_Abnf, of_Self} out_fmt = of_Default;
-	enum {if_File, if_Internal} cur_in_fmt = if_Internal, in_flags[MAX_IN_FILES];
-	static char short_opts[] = "+f:o:t:n:FhHivV";
-	int i, c, in_file_count = 0, force_flag = 0, instantiate = 1;
-	char *machine_name = "generated_from_abnf";
-	struct abnf_str in_files[MAX_IN_FILES];
-	char *out_file = NULL;
-	struct abnf_rule *rules = NULL, *pr;
-	FILE *out_stream, *in_stream;
+struct output {
+	enum out_fmt fmt;
+	char *file;
+	FILE *stream;
+	struct abnf_rule *rules;
 	struct abnf_print_info info;
+	char *machine_name;
+	int instantiate;
+	pthread_t thread;
+	int started;
+	char *tmp_file;  /* replaces file when closed if content differs, see -u */
+};
+
+static int add_output(struct output *outputs, int *count, enum out_fmt fmt, char *file) {
+	struct output *o;
+	o = *count ? &outputs[*count-1] : NULL;
+	if (!o || (fmt && o->fmt) || (file && o->file)) {
+		if (*count >= MAX_OUTPUTS) {
+			fprintf(stderr, "ERROR: too many outputs, max. %d\n", MAX_OUTPUTS);
+			return -1;
+		}
+		o = &outputs[(*count)++];
+		memset(o, 0, sizeof(*o));
+	}
+	if (fmt) o->fmt = fmt;
+	if (file) o->file = file;
+	return 0;
+}
+
+/* ragel does not support forward links so it gets copies of rules ordered by dependencies,
+ * the grammar keeps its order for other outputs
+ */
+static int dependency_ordered_rules(struct abnf_grammar *g, struct abnf_rule **rules) {
+	struct abnf_rule *pr, **order, *copies;
+	unsigned int i, n;
+	*rules = NULL;
+	for (pr = g->rules, n = 0; pr; pr = pr->next, n++);
+	if (n == 0) return 0;
+	order = abnf_malloc(sizeof(*order)*n);
+	copies = abnf_malloc(sizeof(*copies)*n);
+	if (!order || !copies) {
+		if (order) abnf_free(order);
+		if (copies) abnf_free(copies);
+		return -1;
+	}
+	for (pr = g->rules, i = 0; pr; pr = pr->next, i++) {
+		order[i] = pr;
+	}
+	abnf_resolve_rule_dependencies(stderr, &g->rules);
+	for (pr = g->rules, i = 0; pr; pr = pr->next, i++) {
+		copies[i] = *pr;
+		copies[i].prev = i > 0 ? &copies[i-1] : NULL;
+		copies[i].next = i+1 < n ? &copies[i+1] : NULL;
+	}
+	for (i = 0; i < n; i++) {
+		order[i]->prev = i > 0 ? order[i-1] : NULL;
+		order[i]->next = i+1 < n ? order[i+1] : NULL;
+	}
+	g->rules = order[0];
+	abnf_free(order);
+	*rules = copies;
+	return 0;
+}
+
+/* printers only read rules so they may run concurrently */
+static void* print_worker(void *arg) {
+	struct output *o = arg;
+	switch (o->fmt) {
+		case of_Default:
+		case of_Ragel:
+			abnf_print_ragel_rules(o->stream, o->rules, &o->info,
+					       o->machine_name?o->machine_name:"generated_from_abnf", o->instantiate);
+			break;
+		case of_Abnf:
+			abnf_print_abnf_rules(o->stream, o->rules, &o->info);
+			break;
+		case of_Self:
+			if (abnf_print_self_rules(o->stream, o->rules, &o->info, o->machine_name?o->machine_name:"custom") < 0) {
+				fprintf(stderr, "ERROR: cannot write self rule list\n");
+			}
+			break;
+		case of_Bin:
+			if (abnf_print_bin_rules(o->stream, o->rules, &o->info) < 0) {
+				fprintf(stderr, "ERROR: cannot write binary rule list\n");
+			}
+			break;
+		default:
+			;
+	}
+	return NULL;
+}
+
+static void print_outputs(struct output *outputs, int count) {
+	int i;
+	for (i=0; i<count; i++) {
+		outputs[i].started = count > 1 && pthread_create(&outputs[i].thread, NULL, print_worker, &outputs[i]) == 0;
+		if (!outputs[i].started) print_worker(&outputs[i]);
+	}
+	for (i=0; i<count; i++) {
+		if (outputs[i].started) pthread_join(outputs[i].thread, NULL);
+	}
+}
+
+/* output file is replaced only if content differs so its timestamp is kept for make */
+static int open_output(struct output *o, int update_fl, mode_t file_umask) {
+	struct stat st;
+	int fd, exists, err;
+	size_t n;
+	o->stream = NULL;
+	o->tmp_file = NULL;
+	exists = stat(o->file, &st) == 0;
+	if (!update_fl || (exists && !S_ISREG(st.st_mode))) {
+		o->stream = fopen(o->file, "w+");
+		return o->stream ? 0 : -1;
+	}
+	n = strlen(o->file) + sizeof(".XXXXXX");
+	o->tmp_file = abnf_malloc(n);
+	if (!o->tmp_file) return -1;
+	snprintf(o->tmp_file, n, "%s.XXXXXX", o->file);
+	fd = mkstemp(o->tmp_file);
+	if (fd >= 0) {
+		fchmod(fd, exists ? st.st_mode & 07777 : 0666 & ~file_umask);
+		o->stream = fdopen(fd, "w+");
+		if (!o->stream) {
+			err = errno;
+			close(fd);
+			unlink(o->tmp_file);
+			errno = err;
+		}
+	}
+	if (!o->stream) {
+		abnf_free(o->tmp_file);
+		o->tmp_file = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static int same_content(FILE *stream, char *file_name) {
+	FILE *f;
+	char buff1[16384], buff2[16384];
+	size_t n1, n2;
+	int ret = 0;
+	f = fopen(file_name, "r");
+	if (!f) return 0;
+	rewind(stream);
+	for (;;) {
+		n1 = fread(buff1, 1, sizeof(buff1), stream);
+		n2 = fread(buff2, 1, sizeof(buff2), f);
+		if (n1 != n2 || memcmp(buff1, buff2, n1) != 0) break;
+		if (n1 < sizeof(buff1)) {
+			ret = !ferror(stream) && !ferror(f);
+			break;
+		}
+	}
+	fclose(f);
+	return ret;
+}
+
+/* commit is zero when output is incomplete */
+static void close_output(struct output *o, int commit) {
+	if (!o->file || !o->stream) {
+		o->stream = NULL;
+		return;
+	}
+	if (!o->tmp_file) {
+		fclose(o->stream);
+		o->stream = NULL;
+		return;
+	}
+	if (fflush(o->stream) != 0) {
+		fprintf(stderr, "ERROR: %s: %s (errno:%d)\n", o->tmp_file, strerror(errno), errno);
+		commit = 0;
+	}
+	if (commit && same_content(o->stream, o->file)) {
+		if (verbose) fprintf(stdout, "unchanged: %s\n", o->file);
+		commit = 0;
+	}
+	fclose(o->stream);
+	o->stream = NULL;
+	if (commit && rename(o->tmp_file, o->file) < 0) {
+		fprintf(stderr, "ERROR: %s: %s (errno:%d)\n", o->file, strerror(errno), errno);
+		commit = 0;
+	}
+	if (!commit) unlink(o->tmp_file);
+	abnf_free(o->tmp_file);
+	o->tmp_file = NULL;
+}
+
+static void close_outputs(struct output *outputs, int count, int commit) {
+	int i;
+	for (i=0; i<count; i++) {
+		close_output(&outputs[i], commit);
+	}
+}
+
+/* make dependency fragment of output files, names are escaped as by gcc -MD */
+static void print_make_name(FILE *stream, char *s) {
+	for (; *s; s++) {
+		if (*s == ' ' || *s == '\t' || *s == '#')
+			fputc('\\', stream);
+		else if (*s == '$')
+			fputc('$', stream);
+		fputc(*s, stream);
+	}
+}
+
+static int is_dependency(struct abnf_str name, enum in_fmt flag) {
+	return !is_stdin(name) && !(flag == if_Internal && is_internal_list(name));  /* built-in lists are part of binary */
+}
+
+static void print_dependencies(FILE *stream, struct output *outputs, int out_count, struct abnf_str *in_files, enum in_fmt *in_flags, int in_file_count, int phony_fl) {
+	int i, n;
+	for (i=0, n=0; i<out_count; i++) {
+		if (!outputs[i].file) continue;
+		if (n++) fputc(' ', stream);
+		print_make_name(stream, outputs[i].file);
+	}
+	fputc(':', stream);
+	for (i=0; i<in_file_count; i++) {
+		if (!is_dependency(in_files[i], in_flags[i])) continue;
+		fprintf(stream, " \\\n  ");
+		print_make_name(stream, in_files[i].s);  /* it's null terminated */
+	}
+	fputc('\n', stream);
+	/* deleted input won't break make */
+	for (i=0; phony_fl && i<in_file_count; i++) {
+		if (!is_dependency(in_files[i], in_flags[i])) continue;
+		fputc('\n', stream);
+		print_make_name(stream, in_files[i].s);
+		fprintf(stream, ":\n");
+	}
+}
+
+/* reproducible date, see https://reproducible-builds.org/specs/source-date-epoch/ */
+static time_t source_date_epoch() {
+	char *s, *end;
+	long long t;
+	s = getenv("SOURCE_DATE_EPOCH");
+	if (!s || !*s) return 0;
+	errno = 0;
+	t = strtoll(s, &end, 10);
+	if (errno || *end || t <= 0 || (time_t) t != t) {
+		fprintf(stderr, "WARNING: bad SOURCE_DATE_EPOCH '%s' ignored\n", s);
+		return 0;
+	}
+	return t;
+}
+
+/* compile server protocol, request header is followed by argument strings and
+ * SOURCE_DATE_EPOCH of client ("" if unset), stdin, stdout, stderr and working
+ * directory of client are passed as descriptors and exit code is returned
+ */
+#define SERVER_MAGIC "abnfc-rq"
+#define SERVER_FD_COUNT 4
+#ifndef SERVER_MAX_ARGS_SIZE
+#define SERVER_MAX_ARGS_SIZE (1024*1024)
+#endif
+#ifndef SERVER_TIMEOUT
+#define SERVER_TIMEOUT 10  /* seconds a client may stall request or reply */
+#endif
+
+struct server_request {
+	char magic[8];
+	char version[16];
+	uint32_t argc;
+	uint32_t size;  /* of argument strings including terminating zeros */
+	uint32_t umask;  /* outputs are created with umask of client */
+};
+
+union server_fds {
+	char buff[CMSG_SPACE(sizeof(int)*SERVER_FD_COUNT)];
+	struct cmsghdr align;
+};
+
+static int abnfc(int argc, char** argv, int standalone);
+
+static int client_stdin = -1;  /* of request being served */
+
+/* server must not block on stdin of client, regular file is read directly, other
+ * input is read into memory with an idle deadline, stdin FILE of server is not reused
+ * so nothing buffered leaks between requests */
+static FILE *open_stdin(char **buff) {
+	struct stat st;
+	struct pollfd pfd;
+	size_t len = 0, size = 0;
+	ssize_t n;
+	char *p;
+	FILE *in;
+	int fd;
+
+	*buff = NULL;
+	if (client_stdin < 0) return stdin;
+	if (fstat(client_stdin, &st) == 0 && S_ISREG(st.st_mode)) {
+		fd = dup(client_stdin);
+		in = fd < 0 ? NULL : fdopen(fd, "r");
+		if (!in) {
+			if (fd >= 0) close(fd);
+			goto err_errno;
+		}
+		return in;
+	}
+	pfd.fd = client_stdin;
+	pfd.events = POLLIN;
+	while (1) {
+		if (len == size) {
+			size = size ? size*2 : 65536;
+			p = abnf_realloc(*buff, size);
+			if (!p) {
+				fprintf(stderr, "ERROR: not enough memory for stdin\n");
+				goto err;
+			}
+			*buff = p;
+		}
+		n = poll(&pfd, 1, SERVER_TIMEOUT*1000);
+		if (n == 0) {
+			fprintf(stderr, "ERROR: stdin: nothing to read for %d s\n", SERVER_TIMEOUT);
+			goto err;
+		}
+		if (n > 0) n = read(client_stdin, *buff+len, size-len);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN) continue;
+			goto err_errno;
+		}
+		if (n == 0) break;
+		len += n;
+	}
+	in = len ? fmemopen(*buff, len, "r") : fopen("/dev/null", "r");
+	if (!in) goto err_errno;
+	return in;
+err_errno:
+	fprintf(stderr, "ERROR: stdin: %s (errno:%d)\n", strerror(errno), errno);
+err:
+	if (*buff) abnf_free(*buff);
+	*buff = NULL;
+	return NULL;
+}
+
+static void close_stdin(FILE *in, char *buff) {
+	if (in != stdin) fclose(in);
+	if (buff) abnf_free(buff);
+}
+
+static int read_all(int fd, void *buff, size_t len) {
+	ssize_t n;
+	while (len) {
+		n = read(fd, buff, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		buff = (char *) buff + n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int write_all(int fd, const void *buff, size_t len) {
+	ssize_t n;
+	while (len) {
+		n = write(fd, buff, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		buff = (const char *) buff + n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int server_address(char *socket_name, struct sockaddr_un *addr) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(socket_name) >= sizeof(addr->sun_path)) {
+		fprintf(stderr, "ERROR: socket name too long '%s'\n", socket_name);
+		return -1;
+	}
+	strcpy(addr->sun_path, socket_name);
+	return 0;
+}
+
+static int run_client(char *socket_name, int argc, char **argv) {
+	struct sockaddr_un addr;
+	struct server_request req;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union server_fds ctrl;
+	int fds[SERVER_FD_COUNT], sock, i;
+	int32_t status;
+	char *epoch;
+
+	if (server_address(socket_name, &addr) < 0) return 2;
+	epoch = getenv("SOURCE_DATE_EPOCH");
+	if (!epoch) epoch = "";
+	fds[0] = STDIN_FILENO;
+	fds[1] = STDOUT_FILENO;
+	fds[2] = STDERR_FILENO;
+	fds[3] = open(".", O_RDONLY);
+	if (fds[3] < 0) {
+		fprintf(stderr, "ERROR: cannot open working directory: %s (errno:%d)\n", strerror(errno), errno);
+		return 2;
+	}
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0 || connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "ERROR: %s: %s (errno:%d)\n", socket_name, strerror(errno), errno);
+		goto err;
+	}
+	memset(&req, 0, sizeof(req));
+	memcpy(req.magic, SERVER_MAGIC, sizeof(req.magic));
+	strncpy(req.version, VERSION_S, sizeof(req.version)-1);
+	req.argc = argc;
+	for (i=0; i<argc; i++) {
+		req.size += strlen(argv[i])+1;
+	}
+	req.size += strlen(epoch)+1;
+	req.umask = umask(0);
+	umask(req.umask);
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &req;
+	iov.iov_len = sizeof(req);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl.buff;
+	msg.msg_controllen = sizeof(ctrl.buff);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	if (sendmsg(sock, &msg, 0) != sizeof(req))
+		goto err_io;
+	for (i=0; i<argc; i++) {
+		if (write_all(sock, argv[i], strlen(argv[i])+1) < 0)
+			goto err_io;
+	}
+	if (write_all(sock, epoch, strlen(epoch)+1) < 0)
+		goto err_io;
+	if (read_all(sock, &status, sizeof(status)) < 0)
+		goto err_io;
+	close(sock);
+	close(fds[3]);
+	return status;
+
+err_io:
+	fprintf(stderr, "ERROR: communication with compile server failed\n");
+err:
+	if (sock >= 0) close(sock);
+	close(fds[3]);
+	return 2;
+}
 
-	#define append_rule(_pr_) {\
-		if (_pr_) { \
-			if (rules == NULL) { \
-				rules = (_pr_); \
-			} \
-			else { \
-				struct abnf_rule *last_rule = NULL; \
-				for (last_rule = rules; last_rule->next; last_rule=last_rule->next);\
-				last_rule->next = (_pr_); \
-				(_pr_)->prev = last_rule; \
-			} \
-		} \
+static int serve_request(int conn, int std_fds[]) {
+	struct server_request req;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union server_fds ctrl;
+	int fds[SERVER_FD_COUNT], i, n, fd_count = 0;
+	char *args = NULL, **argv = NULL, *epoch;
+	int32_t status = 2;
+	mode_t old_umask;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &req;
+	iov.iov_len = sizeof(req);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl.buff;
+	msg.msg_controllen = sizeof(ctrl.buff);
+	if (recvmsg(conn, &msg, 0) != sizeof(req))
+		goto err;
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+		fd_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		if (fd_count > SERVER_FD_COUNT) fd_count = SERVER_FD_COUNT;
+		memcpy(fds, CMSG_DATA(cmsg), sizeof(int)*fd_count);
+	}
+	if (fd_count != SERVER_FD_COUNT || (msg.msg_flags & MSG_CTRUNC) ||
+		memcmp(req.magic, SERVER_MAGIC, sizeof(req.magic)) != 0 ||
+		strncmp(req.version, VERSION_S, sizeof(req.version)) != 0 ||
+		req.argc == 0 || req.size > SERVER_MAX_ARGS_SIZE || req.argc >= req.size) {
+		fprintf(stderr, "ERROR: bad compile request\n");
+		goto err;
+	}
+	args = abnf_malloc(req.size);
+	argv = abnf_malloc(sizeof(*argv)*(req.argc+2));
+	if (!args || !argv || read_all(conn, args, req.size) < 0 || args[req.size-1])
+		goto err;
+	for (i=0, n=0; i<req.size; i += strlen(args+i)+1) {
+		if (n > req.argc) goto err;
+		argv[n++] = args+i;
+	}
+	if (n != req.argc+1) goto err;
+	epoch = argv[--n];
+	argv[n] = NULL;
+
+	/* run as if started by client, stdin is read via client_stdin */
+	if (fchdir(fds[3]) < 0) goto err;
+	if ((*epoch ? setenv("SOURCE_DATE_EPOCH", epoch, 1) : unsetenv("SOURCE_DATE_EPOCH")) < 0)
+		goto err;
+	for (i=1; i<3; i++) {
+		if (dup2(fds[i], i) < 0) goto err_restore;
+	}
+	client_stdin = fds[0];
+	old_umask = umask(req.umask & 0777);
+	status = abnfc(n, argv, 0);
+	umask(old_umask);
+	client_stdin = -1;
+err_restore:
+	fflush(stdout);
+	fflush(stderr);
+	for (i=1; i<3; i++) {
+		dup2(std_fds[i], i);
+	}
+err:
+	for (i=0; i<fd_count; i++) {
+		close(fds[i]);
+	}
+	if (args) abnf_free(args);
+	if (argv) abnf_free(argv);
+	return write_all(conn, &status, sizeof(status));
+}
+
+/* remove socket of a previous server only if nobody listens on it anymore */
+static int remove_stale_socket(char *socket_name, struct sockaddr_un *addr) {
+	struct stat st;
+	int sock, ret;
+
+	if (lstat(socket_name, &st) < 0)
+		return errno == ENOENT ? 0 : -1;
+	if (!S_ISSOCK(st.st_mode)) {
+		errno = EEXIST;
+		return -1;
+	}
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) return -1;
+	ret = connect(sock, (struct sockaddr *) addr, sizeof(*addr));
+	close(sock);
+	if (ret == 0) {
+		errno = EADDRINUSE;
+		return -1;
+	}
+	if (errno != ECONNREFUSED) return -1;
+	return unlink(socket_name);
+}
+
+static int run_server(char *socket_name) {
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	struct timeval tv;
+	mode_t old_umask;
+	int sock, conn, cwd, i, std_fds[3], bound = 0, ret = 2;
+
+	if (server_address(socket_name, &addr) < 0) return 2;
+	resident.files = abnf_malloc(sizeof(*resident.files)*MAX_RESIDENT_FILES);
+	if (!resident.files) {
+		fprintf(stderr, "ERROR: not enough memory for resident files\n");
+		return 2;
+	}
+	resident.count = 0;
+	cwd = open(".", O_RDONLY);
+	for (i=0; i<3; i++) {
+		std_fds[i] = dup(i);
+	}
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (cwd < 0 || std_fds[0] < 0 || std_fds[1] < 0 || std_fds[2] < 0 || sock < 0 ||
+		remove_stale_socket(socket_name, &addr) < 0) {
+		fprintf(stderr, "ERROR: %s: %s (errno:%d)\n", socket_name, strerror(errno), errno);
+		goto err;
+	}
+	/* socket is created private, no window before a chmod */
+	old_umask = umask(077);
+	bound = bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+	umask(old_umask);
+	if (!bound || listen(sock, SOMAXCONN) < 0) {
+		fprintf(stderr, "ERROR: %s: %s (errno:%d)\n", socket_name, strerror(errno), errno);
+		goto err;
 	}
+	tv.tv_sec = SERVER_TIMEOUT;
+	tv.tv_usec = 0;
+	/* client may disappear, ^C must interrupt accept */
+	signal(SIGPIPE, SIG_IGN);
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sig_term;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGQUIT, &sa, NULL);
+	while (!abnf_stop_flag) {
+		conn = accept(sock, NULL, NULL);
+		if (conn < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			fprintf(stderr, "ERROR: %s: %s (errno:%d)\n", socket_name, strerror(errno), errno);
+			goto err;
+		}
+		/* a stalled client must not block the server */
+		setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		serve_request(conn, std_fds);
+		close(conn);
+		if (fchdir(cwd) < 0) goto err;
+		resident.request++;
+		if (resident.count >= MAX_RESIDENT_FILES) resident_trim(MAX_RESIDENT_FILES/2);
+	}
+	ret = 0;
+err:
+	if (sock >= 0) close(sock);
+	if (bound) unlink(socket_name);
+	for (i=0; i<3; i++) {
+		if (std_fds[i] >= 0) close(std_fds[i]);
+	}
+	if (cwd >= 0) close(cwd);
+	resident_trim(0);
+	abnf_free(resident.files);
+	resident.files = NULL;
+	return ret;
+}
+
+/* standalone is zero when command line is processed by compile server for a client */
+static int abnfc(int argc, char** argv, int standalone) {
+
+	enum out_fmt out_fmt = of_Default;
+	enum in_fmt cur_in_fmt = if_Internal, *in_flags = NULL;
+	static char short_opts[] = "+f:o:t:n:r:j:C:D:c:M:S:aFhHiORuvV";
+	int i, c, in_file_count = 0, in_file_size = 0, force_flag = 0, instantiate = 1, thread_count = 0, out_count = 0;
+	int start_count = 0, start_size = 0;
+	int no_date_fl = 0, update_fl = 0, optimize_fl = 0, analyze_fl = 0, estimate_fl = 0, dep_fl = 0, dep_phony_fl = 0;
+	char *dep_file = NULL, dep_file_buff[PATH_MAX], *endp;
+	unsigned long long max_states = 0;
+	struct output dep_out;
+	mode_t file_umask;
+	char *machine_name = NULL, *server_socket = NULL, *client_socket = NULL;
+	struct abnf_str *in_files = NULL, *start_rules = NULL;
+	struct output outputs[MAX_OUTPUTS];
+	struct abnf_rule *ragel_rules = NULL;
+	struct abnf_grammar grammar;
+	FILE *in_stream;
+	char *in_buff;
+	struct abnf_print_info info;
+	struct parse_job *jobs = NULL;
+
+	abnf_init_grammar(&grammar);
+	grammar.flags |= ABNF_GRAMMAR_ZERO_COPY;  /* input files live until program exits */
+	verbose = 0;
+	cache_dir = NULL;
+	job_queue.jobs = NULL;
 
 	/* look if there is a -h, e.g. -f -h construction won't catch it later */
+	optind = 0;  /* full getopt reinitialization when called by server */
 	opterr = 0;
 	while (optind < argc) {
 		c = getopt(argc, argv, short_opts);
@@ -127,8 +1143,17 @@ int main(int argc, char** argv) {
 			print_help(argv[0]);
 			return 0;
 		}
+		if (c == 'D') server_socket = optarg;
+		if (c == 'c') client_socket = optarg;
 		if (c == -1) optind++;
 	}
+	/* server ignores -D and -c of client command line */
+	if (standalone && client_socket) {
+		return run_client(client_socket, argc, argv);
+	}
+	if (standalone && server_socket) {
+		return run_server(server_socket);
+	}
 	optind = 1;  /* reset getopt */
 	opterr = 0;
 	while (optind < argc) {
@@ -136,36 +1161,35 @@ int main(int argc, char** argv) {
 		if (optind > argc)
 			break;
 		if (c == -1) {
-			if (in_file_count < MAX_IN_FILES) {
-				in_files[in_file_count] = abnf_mk_str(argv[optind]);
-				in_flags[in_file_count] = cur_in_fmt;
-				in_file_count++;
-			}
+			if (add_in_file(&in_files, &in_flags, &in_file_count, &in_file_size, abnf_mk_str(argv[optind]), cur_in_fmt) < 0)
+				goto err;
 			optind++;
 		}
 		else {
 			switch (c) {
 				case 'f':
-					if (out_fmt) {
-						fprintf(stderr, "ERROR: only one -f options allowed\n");
-						goto err;
-					}
 					if (strcasecmp("rl", optarg)==0 || strcasecmp("ragel", optarg)==0)
 						out_fmt = of_Ragel;
 					else if (strcasecmp("abnf", optarg)==0)
 						out_fmt = of_Abnf;
 					else if (strcasecmp("self", optarg)==0)
 						out_fmt = of_Self;
+					else if (strcasecmp("bin", optarg)==0)
+						out_fmt = of_Bin;
 					else {
 						fprintf(stderr, "ERROR: unknown format '-f %s'\n", optarg);
 						goto err;
 					}
+					if (add_output(outputs, &out_count, out_fmt, NULL) < 0)
+						goto err;
 					break;
 				case 't':
 					if (strcasecmp("self", optarg)==0)
 						cur_in_fmt = if_Internal;
 					else if (strcasecmp("file", optarg)==0)
 						cur_in_fmt = if_File;
+					else if (strcasecmp("bin", optarg)==0)
+						cur_in_fmt = if_Bin;
 					else {
 						fprintf(stderr, "ERROR: unknown type '-t %s'\n", optarg);
 						goto err;
@@ -179,8 +1203,19 @@ int main(int argc, char** argv) {
 						goto err;
 					}
 					break;
+				case 'r':
+					if (add_start_rules(&start_rules, &start_count, &start_size, optarg) < 0)
+						goto err;
+					break;
 				case 'o':
-					out_file = optarg;
+					if (add_output(outputs, &out_count, of_Default, optarg) < 0)
+						goto err;
+					break;
+				case 'C':
+					cache_dir = optarg;
+					break;
+				case 'D':
+				case 'c':
 					break;
 				case 'F':
 					force_flag++;
@@ -188,6 +1223,49 @@ int main(int argc, char** argv) {
 			        case 'i':
 				        instantiate = 0;
 					break;
+				case 'M':
+					/* -MD, -MP, -MF file or -MFfile */
+					if (strcmp(optarg, "D") == 0)
+						dep_fl = 1;
+					else if (strcmp(optarg, "P") == 0)
+						dep_phony_fl = 1;
+					else if (optarg[0] == 'F' && (optarg[1] || optind < argc)) {
+						dep_fl = 1;
+						dep_file = optarg[1] ? optarg+1 : argv[optind++];
+					}
+					else {
+						fprintf(stderr, "ERROR: unknown option '-M%s'\n", optarg);
+						goto err;
+					}
+					break;
+				case 'O':
+					optimize_fl = 1;
+					break;
+				case 'a':
+					analyze_fl = 1;
+					break;
+				case 'S':
+					errno = 0;
+					max_states = strtoull(optarg, &endp, 10);
+					if (errno || endp == optarg || *endp || optarg[0] == '-') {
+						fprintf(stderr, "ERROR: bad number of states '-S %s'\n", optarg);
+						goto err;
+					}
+					estimate_fl = 1;
+					break;
+				case 'R':
+					no_date_fl = 1;
+					break;
+				case 'u':
+					update_fl = 1;
+					break;
+				case 'j':
+					thread_count = atoi(optarg);
+					if (thread_count <= 0) {
+						fprintf(stderr, "ERROR: bad number of jobs '-j %s'\n", optarg);
+						goto err;
+					}
+					break;
 				case 'v':
 					verbose++;
 					break;
@@ -205,102 +1283,255 @@ int main(int argc, char** argv) {
 		}
 	}
 
-	SIGNAL(SIGTERM);
-	SIGNAL(SIGINT);
-	SIGNAL(SIGQUIT);
+	if (out_count == 0) {
+		add_output(outputs, &out_count, of_Default, NULL);
+	}
+	for (i=0, c=0; i < out_count; i++) {
+		if (!outputs[i].file) c++;
+	}
+	if (c > 1) {
+		fprintf(stderr, "ERROR: only one output may be written to stdout, use -o\n");
+		goto err;
+	}
+	if (dep_fl && !dep_file) {
+		for (i=0; i < out_count && !outputs[i].file; i++);
+		if (i == out_count || snprintf(dep_file_buff, sizeof(dep_file_buff), "%s.d", outputs[i].file) >= sizeof(dep_file_buff)) {
+			fprintf(stderr, "ERROR: -MD requires output file or -MF file\n");
+			goto err;
+		}
+		dep_file = dep_file_buff;
+	}
+	if (dep_fl && c == out_count) {
+		fprintf(stderr, "ERROR: -MD requires output file\n");
+		goto err;
+	}
+
+	if (standalone) {
+		SIGNAL(SIGTERM);
+		SIGNAL(SIGINT);
+		SIGNAL(SIGQUIT);
+	}
 
 	if (in_file_count == 0) {
-		in_files[in_file_count] = abnf_mk_str("");  /* stdin */
-		in_flags[in_file_count] = if_File;
-		in_file_count++;
+		/* stdin */
+		if (add_in_file(&in_files, &in_flags, &in_file_count, &in_file_size, abnf_mk_str(""), if_File) < 0)
+			goto err_2;
+	}
+	/* named files are parsed by worker threads, stdin and internal lists in order when merging */
+	if (thread_count == 0) {
+		thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	jobs = abnf_malloc(sizeof(*jobs)*in_file_count);
+	if (!jobs) goto err_2;
+	for (i=0; i < in_file_count; i++) {
+		jobs[i].name = in_files[i];
+		jobs[i].status = 0;
+		jobs[i].queued = !is_stdin(in_files[i]) && (in_flags[i] == if_File || (in_flags[i] == if_Internal && !is_internal_list(in_files[i])));
+		if (jobs[i].queued) {
+			abnf_init_grammar(&jobs[i].grammar);
+			jobs[i].grammar.flags = grammar.flags;
+		}
+	}
+	if (parse_files_concurrently(jobs, in_file_count, thread_count) < 0) {
+		fprintf(stderr, "ERROR: cannot start parser threads\n");
+		goto err_2;
 	}
+
 	for (i=0; i < in_file_count; i++) {
-		if (abnf_stop_flag) return 0;
+		if (abnf_stop_flag) {
+			destroy_jobs(jobs, in_file_count);
+			goto destroy;
+		}
 		switch (in_flags[i]) {
 			case if_File:
 				/* stdin / file */
 			try_file:
-				if (!in_files[i].len || (strcmp(in_files[i].s, "-") == 0)) {
+				if (is_stdin(in_files[i])) {
 					if (verbose) fprintf(stdout, "infile: stdin\n");
-					if (abnf_parse_abnf(stdin, &rules, in_files[i]) < 0) goto err_2;
+					in_stream = open_stdin(&in_buff);
+					if (!in_stream) goto err_2;
+					c = abnf_parse_abnf(in_stream, &grammar, in_files[i]);
+					close_stdin(in_stream, in_buff);
+					if (c < 0) goto err_2;
+				}
+				else if (job_queue.jobs) {
+					/* already parsed by worker */
+					if (verbose) fprintf(stdout, "infile: %s\n", in_files[i].s);
+					if (jobs[i].status < 0) goto err_2;
+					if (abnf_grammar_merge(&grammar, &jobs[i].grammar) < 0) goto err_2;
 				}
 				else {
 					if (verbose) fprintf(stdout, "infile: %s\n", in_files[i].s);
-					in_stream = fopen(in_files[i].s, "r");  /* it's null terminated */
-					if (!in_stream) {
-						fprintf(stderr, "ERROR: %s (errno:%d)\n", strerror(errno), errno);
-						goto err_2;
-					}
-					if (abnf_parse_abnf(in_stream, &rules, in_files[i]) < 0) goto err_2;
-					fclose(in_stream);
+					if (parse_file(in_files[i], &grammar) < 0) goto err_2;
 				}
 				break;
 			case if_Internal:
 				if (verbose) fprintf(stdout, "self: %s\n", in_files[i].s);
 				if (strcasecmp("core", in_files[i].s) == 0) {  /* we can do it, it's null terminated */
-					pr = abnf_declare_core_rules(NULL);
+					if (abnf_declare_core_rules(&grammar) < 0) goto err_2;
 				}
 				else if (strcasecmp("abnf", in_files[i].s) == 0) {
-					pr = abnf_declare_abnf_rules(NULL);
+					if (abnf_declare_abnf_rules(&grammar) < 0) goto err_2;
 				}
 				else {
 					goto try_file;
 				}
-				append_rule(pr);
+				break;
+			case if_Bin:
+				if (is_stdin(in_files[i])) {
+					if (verbose) fprintf(stdout, "bin: stdin\n");
+					in_stream = open_stdin(&in_buff);
+					if (!in_stream) goto err_2;
+					c = abnf_parse_bin(in_stream, &grammar, abnf_mk_str(NULL));
+					close_stdin(in_stream, in_buff);
+					if (c < 0) goto err_2;
+				}
+				else {
+					if (verbose) fprintf(stdout, "bin: %s\n", in_files[i].s);
+					in_stream = fopen(in_files[i].s, "r");  /* it's null terminated */
+					if (!in_stream) {
+						fprintf(stderr, "ERROR: %s: %s (errno:%d)\n", in_files[i].s, strerror(errno), errno);
+						goto err_2;
+					}
+					c = abnf_parse_bin(in_stream, &grammar, abnf_mk_str(NULL));
+					fclose(in_stream);
+					if (c < 0) goto err_2;
+				}
 				break;
 			default:
 				;
 		}
 	}
-	if (abnf_stop_flag) return 0;
+	destroy_jobs(jobs, in_file_count);
+	jobs = NULL;
+	if (abnf_stop_flag) goto destroy;
 
-	if (out_file) {
-		if (verbose) fprintf(stdout, "outfile: %s\n", out_file);
-		out_stream = fopen(out_file, "w+");
+	if (abnf_check_rules(&grammar) != 0 && force_flag == 0) {
+		abnf_destroy_grammar(&grammar);
+		c = 3;
+		goto free_files;
 	}
-	else {
-		if (verbose) fprintf(stdout, "outfile: stdout\n");
-		out_stream = stdout;
+
+	if (start_count) {
+		c = abnf_select_rules(&grammar, start_rules, start_count);
+		if (c < 0) goto err_2;
+		if (verbose) fprintf(stdout, "unreachable rules removed: %d\n", c);
+	}
+
+	if (analyze_fl && abnf_analyze_rules(&grammar) < 0)
+		goto err_2;
+
+	if (optimize_fl) {
+		struct abnf_optimize_info opt;
+		abnf_optimize_rules(&grammar, &opt);
+		fprintf(stderr, "optimized: rules %u -> %u, alternations %u -> %u, concatenations %u -> %u, inlined %u, classes %u\n",
+			opt.before.rules, opt.after.rules, opt.before.alternations, opt.after.alternations,
+			opt.before.concatenations, opt.after.concatenations, opt.inlined, opt.classes);
+		/* folded classes may leave rules unreferenced */
+		if (start_count && abnf_select_rules(&grammar, start_rules, start_count) < 0)
+			goto err_2;
 	}
-	if (abnf_check_rules(stderr, rules) != 0 && force_flag == 0) {
-		return 3;
+
+	if (estimate_fl) {
+		c = abnf_estimate_states(&grammar, max_states, MAX_LISTED_RULES);
+		if (c < 0) goto err_2;
+		if (c > 0 && force_flag == 0) {
+			abnf_destroy_grammar(&grammar);
+			c = 3;
+			goto free_files;
+		}
 	}
 
+	memset(&info, 0, sizeof(info));
 	info.in_files = in_files;
 	info.in_file_count = in_file_count;
-	info.out_file = abnf_mk_str(out_file);
-	switch (out_fmt) {
-		case of_Default:
-		case of_Ragel:
-			if (verbose) fprintf(stdout, "outformat: ragel\n");
-			abnf_resolve_rule_dependencies(stderr, &rules);
-			abnf_print_ragel_rules(out_stream, rules, &info,
-					       machine_name, instantiate);
-			break;
-		case of_Abnf:
-			if (verbose) fprintf(stdout, "outformat: abnf\n");
-			abnf_print_abnf_rules(out_stream, rules, &info);
-			break;
-		case of_Self:
-			if (verbose) fprintf(stdout, "outformat: self\n");
-			abnf_print_self_rules(out_stream, rules, &info);
-			break;
-		default:
-			;
+	if (start_count)
+		info.main_rule = start_rules[0];
+	if (no_date_fl)
+		info.flags |= ABNF_PRINT_NO_DATE;
+	else
+		info.date = source_date_epoch();
+	file_umask = umask(0);
+	umask(file_umask);
+	for (i=0; i < out_count; i++) {
+		outputs[i].info = info;
+		outputs[i].info.out_file = abnf_mk_str(outputs[i].file);
+		outputs[i].machine_name = machine_name;
+		outputs[i].instantiate = instantiate;
+		outputs[i].rules = grammar.rules;
+		if (outputs[i].file) {
+			if (verbose) fprintf(stdout, "outfile: %s\n", outputs[i].file);
+			if (open_output(&outputs[i], update_fl, file_umask) < 0) {
+				fprintf(stderr, "ERROR: %s: %s (errno:%d)\n", outputs[i].file, strerror(errno), errno);
+				goto err_3;
+			}
+		}
+		else {
+			if (verbose) fprintf(stdout, "outfile: stdout\n");
+			outputs[i].stream = stdout;
+		}
+		switch (outputs[i].fmt) {
+			case of_Default:
+			case of_Ragel:
+				if (verbose) fprintf(stdout, "outformat: ragel\n");
+				if (!ragel_rules && dependency_ordered_rules(&grammar, &ragel_rules) < 0) {
+					fprintf(stderr, "ERROR: not enough memory for rule dependencies\n");
+					goto err_3;
+				}
+				outputs[i].rules = ragel_rules;
+				break;
+			case of_Abnf:
+				if (verbose) fprintf(stdout, "outformat: abnf\n");
+				break;
+			case of_Self:
+				if (verbose) fprintf(stdout, "outformat: self\n");
+				break;
+			case of_Bin:
+				if (verbose) fprintf(stdout, "outformat: bin\n");
+				break;
+			default:
+				;
+		}
 	}
-	abnf_destroy_rules(rules);
-    if (out_file) {
-		fclose(out_stream);
+	print_outputs(outputs, out_count);
+	close_outputs(outputs, out_count, !abnf_stop_flag);
+	if (ragel_rules) abnf_free(ragel_rules);
+	if (dep_fl && !abnf_stop_flag) {
+		if (verbose) fprintf(stdout, "depfile: %s\n", dep_file);
+		memset(&dep_out, 0, sizeof(dep_out));
+		dep_out.file = dep_file;
+		if (open_output(&dep_out, update_fl, file_umask) < 0) {
+			fprintf(stderr, "ERROR: %s: %s (errno:%d)\n", dep_file, strerror(errno), errno);
+			goto err_2;
+		}
+		print_dependencies(dep_out.stream, outputs, out_count, in_files, in_flags, in_file_count, dep_phony_fl);
+		close_output(&dep_out, 1);
 	}
 
-//destroy:
-	return 0;
+destroy:
+	abnf_destroy_grammar(&grammar);
+	c = 0;
+	goto free_files;
 
 err:
-	abnf_destroy_rules(rules);
+	abnf_destroy_grammar(&grammar);
 	fprintf(stderr, "Type '%s -h <command>' for help on a specific command.\n", basename(argv[0]));
-	return 1;
+	c = 1;
+	goto free_files;
+err_3:
+	close_outputs(outputs, i+1, 0);
+	if (ragel_rules) abnf_free(ragel_rules);
 err_2:
-	abnf_destroy_rules(rules);
-	return 2;
+	destroy_jobs(jobs, in_file_count);
+	abnf_destroy_grammar(&grammar);
+	c = 2;
+free_files:
+	if (in_files) abnf_free(in_files);
+	if (in_flags) abnf_free(in_flags);
+	if (start_rules) abnf_free(start_rules);
+	return c;
+}
+
+int main(int argc, char** argv) {
+	return abnfc(argc, argv, 1);
 }
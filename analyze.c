@@ -0,0 +1,531 @@
+/*
+ *  Copyright 2007 by Tomas Mandys <tomas.mandys at 2p dot cz>
+ */
+
+/*  This file is part of abnfc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Ragel; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "abnf.h"
+#include <strings.h>
+
+/* nullable, FIRST and FOLLOW byte sets, rules are numbered by internal.index,
+ * sets grow monotonically so iteration stops when nothing changes
+ */
+struct abnf_first {
+	int nullable;
+	struct abnf_char_set first;
+};
+
+struct abnf_analysis {
+	FILE *stream;
+	struct abnf_grammar *g;
+	struct abnf_first *rules;
+	struct abnf_char_set *follow;
+	struct abnf_rule *pr;  /* rule being reported */
+	int changed;
+	int warnings;
+	int failed;  /* out of memory */
+};
+
+#define ABNF_MAX_PRINTED_RANGES 8
+
+static int abnf_an_union(struct abnf_char_set *dst, struct abnf_char_set *src) {
+	int i, changed = 0;
+	for (i = 0; i < 8; i++) {
+		if (src->bits[i] & ~dst->bits[i]) {
+			dst->bits[i] |= src->bits[i];
+			changed = 1;
+		}
+	}
+	return changed;
+}
+
+static int abnf_an_intersect(struct abnf_char_set *dst, struct abnf_char_set *a, struct abnf_char_set *b) {
+	int i, nonempty = 0;
+	for (i = 0; i < 8; i++) {
+		dst->bits[i] = a->bits[i] & b->bits[i];
+		if (dst->bits[i]) nonempty = 1;
+	}
+	return nonempty;
+}
+
+static struct abnf_rule* abnf_an_rule(struct abnf_analysis *an, struct abnf_element *e) {
+	return e->u.rule.resolved?e->u.rule.resolved:abnf_grammar_find_rule(an->g, e->u.rule.name);
+}
+
+static void abnf_an_alternations(struct abnf_analysis *an, struct abnf_alternation *pa, struct abnf_first *f);
+
+static void abnf_an_element(struct abnf_analysis *an, struct abnf_element *e, struct abnf_first *f) {
+	struct abnf_rule *pr;
+	int c;
+	memset(f, 0, sizeof(*f));
+	switch (e->type) {
+		case ABNF_ET_RULE:
+			pr = abnf_an_rule(an, e);
+			if (pr) *f = an->rules[pr->internal.index];  /* unknown rule matches nothing */
+			break;
+		case ABNF_ET_GROUP:
+			abnf_an_alternations(an, e->u.group, f);
+			break;
+		case ABNF_ET_RANGE:
+			for (c = e->u.range.lo; c <= e->u.range.hi; c++)
+				ABNF_CHAR_SET_ADD(f->first, c);
+			break;
+		case ABNF_ET_STRING:
+			if (e->u.string.len)
+				ABNF_CHAR_SET_ADD(f->first, e->u.string.s[0]);
+			else
+				f->nullable = 1;
+			break;
+		case ABNF_ET_TOKEN:
+			if (e->u.token.len) {
+				c = (unsigned char) e->u.token.s[0];
+				ABNF_CHAR_SET_ADD(f->first, c);
+				if (ABNF_IS_ALPHA(c))
+					ABNF_CHAR_SET_ADD(f->first, c ^ 0x20);
+			}
+			else
+				f->nullable = 1;
+			break;
+		default:  /* actions and empty element */
+			f->nullable = 1;
+			break;
+	}
+}
+
+static void abnf_an_repetition(struct abnf_analysis *an, struct abnf_repetition *r, struct abnf_first *f) {
+	if (r->max == 0) {
+		memset(f, 0, sizeof(*f));
+		f->nullable = 1;
+		return;
+	}
+	abnf_an_element(an, &r->element, f);
+	if (r->min == 0)
+		f->nullable = 1;
+}
+
+/* FIRST of concatenation list starting at pc */
+static void abnf_an_concatenations(struct abnf_analysis *an, struct abnf_concatenation *pc, struct abnf_first *f) {
+	struct abnf_first f2;
+	memset(f, 0, sizeof(*f));
+	f->nullable = 1;
+	for (; pc && f->nullable; pc = pc->next) {
+		abnf_an_repetition(an, &pc->repetition, &f2);
+		abnf_an_union(&f->first, &f2.first);
+		f->nullable = f2.nullable;
+	}
+}
+
+static void abnf_an_alternations(struct abnf_analysis *an, struct abnf_alternation *pa, struct abnf_first *f) {
+	struct abnf_first f2;
+	memset(f, 0, sizeof(*f));
+	for (; pa; pa = pa->next) {
+		abnf_an_concatenations(an, pa->concatenation, &f2);
+		abnf_an_union(&f->first, &f2.first);
+		if (f2.nullable) f->nullable = 1;
+	}
+}
+
+static void abnf_an_print_set(FILE *stream, struct abnf_char_set *cs) {
+	int c, hi, n;
+	for (c = 0, n = 0; c < 256; c++) {
+		if (!ABNF_CHAR_SET_HAS(*cs, c)) continue;
+		if (n == ABNF_MAX_PRINTED_RANGES) {
+			fprintf(stream, " ...");
+			break;
+		}
+		for (hi = c; hi < 255 && ABNF_CHAR_SET_HAS(*cs, hi+1); hi++);
+		if (hi > c)
+			fprintf(stream, " %%x%.2x-%.2x", c, hi);
+		else
+			fprintf(stream, " %%x%.2x", c);
+		c = hi;
+		n++;
+	}
+}
+
+static void abnf_an_warning(struct abnf_analysis *an, int depth) {
+	an->warnings++;
+	fprintf(an->stream, "WARNING: rule '%.*s'", an->pr->name.len, an->pr->name.s);
+	if (an->pr->origin.len)
+		fprintf(an->stream, " from '%.*s'", an->pr->origin.len, an->pr->origin.s);
+	if (depth)
+		fprintf(an->stream, ", group level %d", depth);
+	fprintf(an->stream, ": ");
+}
+
+/* alternatives sharing a first byte or both matching empty string */
+static void abnf_an_report_alternations(struct abnf_analysis *an, struct abnf_alternation *pa, int depth) {
+	struct abnf_alternation *pa2;
+	struct abnf_first f1, f2;
+	struct abnf_char_set common;
+	int i, j;
+	for (i = 1; pa; pa = pa->next, i++) {
+		abnf_an_concatenations(an, pa->concatenation, &f1);
+		for (pa2 = pa->next, j = i+1; pa2; pa2 = pa2->next, j++) {
+			abnf_an_concatenations(an, pa2->concatenation, &f2);
+			if (abnf_an_intersect(&common, &f1.first, &f2.first)) {
+				abnf_an_warning(an, depth);
+				fprintf(an->stream, "alternatives %d and %d overlap on", i, j);
+				abnf_an_print_set(an->stream, &common);
+				fprintf(an->stream, "\n");
+			}
+			else if (f1.nullable && f2.nullable) {
+				abnf_an_warning(an, depth);
+				fprintf(an->stream, "alternatives %d and %d both match empty string\n", i, j);
+			}
+		}
+	}
+}
+
+static void abnf_an_follow_alternations(struct abnf_analysis *an, struct abnf_alternation *pa, struct abnf_char_set *follow, int depth);
+
+/* follow is set of bytes which may come after the list, context of each element is derived from it */
+static void abnf_an_follow_concatenations(struct abnf_analysis *an, struct abnf_concatenation *pc, struct abnf_char_set *follow, int depth) {
+	struct abnf_first *bodies, body;
+	struct abnf_char_set after, context, common;
+	struct abnf_concatenation *p;
+	struct abnf_rule *pr;
+	int i, n;
+	for (p = pc, n = 0; p; p = p->next, n++);
+	if (n == 0) return;
+	/* FIRST of each element, then turned into what may follow it from the tail back */
+	bodies = abnf_malloc(sizeof(*bodies)*n);
+	if (!bodies) {
+		an->failed = 1;
+		return;
+	}
+	for (p = pc, i = 0; p; p = p->next, i++)
+		abnf_an_repetition(an, &p->repetition, &bodies[i]);
+	after = *follow;
+	for (i = n-1; i >= 0; i--) {
+		body = bodies[i];
+		bodies[i].first = after;
+		if (!body.nullable)
+			memset(&after, 0, sizeof(after));
+		abnf_an_union(&after, &body.first);
+	}
+	for (i = 1; pc; pc = pc->next, i++) {
+		after = bodies[i-1].first;
+		abnf_an_repetition(an, &pc->repetition, &body);
+		context = after;
+		if (pc->repetition.max > 1)
+			abnf_an_union(&context, &body.first);  /* next iteration */
+
+		if (pc->repetition.element.type == ABNF_ET_RULE) {
+			pr = abnf_an_rule(an, &pc->repetition.element);
+			if (pr && abnf_an_union(&an->follow[pr->internal.index], &context))
+				an->changed = 1;
+		}
+		else if (pc->repetition.element.type == ABNF_ET_GROUP) {
+			abnf_an_follow_alternations(an, pc->repetition.element.u.group, &context, depth+1);
+		}
+
+		if (!an->pr || pc->repetition.max <= pc->repetition.min)
+			continue;
+		/* loop may either continue or exit on the same byte */
+		if (abnf_an_intersect(&common, &body.first, &after)) {
+			abnf_an_warning(an, depth);
+			fprintf(an->stream, "repetition of element %d overlaps what follows on", i);
+			abnf_an_print_set(an->stream, &common);
+			fprintf(an->stream, "\n");
+		}
+		if (pc->repetition.max > 1) {
+			abnf_an_element(an, &pc->repetition.element, &body);
+			if (body.nullable) {
+				abnf_an_warning(an, depth);
+				fprintf(an->stream, "repeated element %d may match empty string\n", i);
+			}
+		}
+	}
+	abnf_free(bodies);
+}
+
+static void abnf_an_follow_alternations(struct abnf_analysis *an, struct abnf_alternation *pa, struct abnf_char_set *follow, int depth) {
+	if (an->pr)
+		abnf_an_report_alternations(an, pa, depth);
+	for (; pa; pa = pa->next) {
+		abnf_an_follow_concatenations(an, pa->concatenation, follow, depth);
+	}
+}
+
+int abnf_analyze_rules(struct abnf_grammar *g) {
+	FILE *stream = abnf_ctx_diag(g->ctx);
+	struct abnf_analysis an;
+	struct abnf_rule *pr;
+	struct abnf_first f;
+	struct abnf_char_set follow;
+	unsigned int n;
+
+	memset(&an, 0, sizeof(an));
+	an.stream = stream;
+	an.g = g;
+	for (pr = g->rules, n = 0; pr; pr = pr->next, n++) {
+		pr->internal.index = n;
+	}
+	if (n == 0) return 0;
+	an.rules = abnf_malloc(sizeof(*an.rules)*n);
+	an.follow = abnf_malloc(sizeof(*an.follow)*n);
+	if (!an.rules || !an.follow) {
+		fprintf(stream, "ERROR: not enough memory\n");
+		if (an.rules) abnf_free(an.rules);
+		if (an.follow) abnf_free(an.follow);
+		return -1;
+	}
+	memset(an.rules, 0, sizeof(*an.rules)*n);
+	memset(an.follow, 0, sizeof(*an.follow)*n);
+
+	/* nullable and FIRST */
+	do {
+		an.changed = 0;
+		for (pr = g->rules; pr; pr = pr->next) {
+			abnf_an_alternations(&an, pr->alternation, &f);
+			if (abnf_an_union(&an.rules[pr->internal.index].first, &f.first))
+				an.changed = 1;
+			if (f.nullable && !an.rules[pr->internal.index].nullable) {
+				an.rules[pr->internal.index].nullable = 1;
+				an.changed = 1;
+			}
+		}
+	} while (an.changed);
+
+	/* FOLLOW, rule passes its follow set to rules it references */
+	do {
+		an.changed = 0;
+		for (pr = g->rules; pr; pr = pr->next) {
+			follow = an.follow[pr->internal.index];
+			abnf_an_follow_alternations(&an, pr->alternation, &follow, 0);
+		}
+	} while (an.changed && !an.failed);
+
+	for (pr = g->rules; pr && !an.failed; pr = pr->next) {
+		an.pr = pr;
+		follow = an.follow[pr->internal.index];
+		abnf_an_follow_alternations(&an, pr->alternation, &follow, 0);
+	}
+	abnf_free(an.rules);
+	abnf_free(an.follow);
+	if (an.failed) {
+		fprintf(stream, "ERROR: not enough memory\n");
+		return -1;
+	}
+	return an.warnings;
+}
+
+/* Ragel expands referenced machines and unrolls bounded repetitions, so the size of a
+ * rule is roughly its NFA size with rules inlined, estimates saturate instead of overflow
+ */
+#define ABNF_STATES_MAX (~0ULL)
+
+struct abnf_estimate {
+	struct abnf_grammar *g;
+	unsigned long long *states;  /* by internal.index, 0 if not yet known */
+	/* recursion groups are strongly connected components found by Tarjan's algorithm */
+	unsigned int *group;  /* by internal.index, 0 while not assigned */
+	unsigned int *num;  /* by internal.index, visit number, 0 if not visited */
+	struct abnf_rule **stack;
+	unsigned int sp, counter, groups;
+};
+
+static struct abnf_rule *abnf_est_resolve(struct abnf_estimate *est, struct abnf_element *e) {
+	return e->u.rule.resolved?e->u.rule.resolved:abnf_grammar_find_rule(est->g, e->u.rule.name);
+}
+
+static unsigned int abnf_est_group_visit(struct abnf_estimate *est, struct abnf_rule *pr);
+
+static void abnf_est_group_alternations(struct abnf_estimate *est, struct abnf_alternation *pa, unsigned int *low) {
+	struct abnf_concatenation *pc;
+	struct abnf_rule *pr;
+	unsigned int l;
+	for (; pa; pa = pa->next) {
+		for (pc = pa->concatenation; pc; pc = pc->next) {
+			if (pc->repetition.element.type == ABNF_ET_GROUP) {
+				abnf_est_group_alternations(est, pc->repetition.element.u.group, low);
+				continue;
+			}
+			if (pc->repetition.element.type != ABNF_ET_RULE)
+				continue;
+			pr = abnf_est_resolve(est, &pc->repetition.element);
+			if (!pr) continue;
+			if (!est->num[pr->internal.index]) {
+				l = abnf_est_group_visit(est, pr);
+				if (l < *low) *low = l;
+			}
+			else if (!est->group[pr->internal.index]) {  /* on stack */
+				if (est->num[pr->internal.index] < *low) *low = est->num[pr->internal.index];
+			}
+		}
+	}
+}
+
+static unsigned int abnf_est_group_visit(struct abnf_estimate *est, struct abnf_rule *pr) {
+	struct abnf_rule *pr2;
+	unsigned int low;
+	low = est->num[pr->internal.index] = ++est->counter;
+	est->stack[est->sp++] = pr;
+	abnf_est_group_alternations(est, pr->alternation, &low);
+	if (low == est->num[pr->internal.index]) {
+		est->groups++;
+		do {
+			pr2 = est->stack[--est->sp];
+			est->group[pr2->internal.index] = est->groups;
+		} while (pr2 != pr);
+	}
+	return low;
+}
+
+static unsigned long long abnf_est_add(unsigned long long a, unsigned long long b) {
+	return a > ABNF_STATES_MAX - b ? ABNF_STATES_MAX : a + b;
+}
+
+static unsigned long long abnf_est_mul(unsigned long long a, unsigned long long b) {
+	return b && a > ABNF_STATES_MAX / b ? ABNF_STATES_MAX : a * b;
+}
+
+static unsigned long long abnf_est_rule(struct abnf_estimate *est, struct abnf_rule *pr);
+
+/* reference within recursion group of estimated rule counts as one state, Ragel cannot
+ * expand it anyway and estimate does not depend on the order rules are visited */
+static unsigned long long abnf_est_alternations(struct abnf_estimate *est, struct abnf_alternation *pa, unsigned int group) {
+	struct abnf_concatenation *pc;
+	struct abnf_element *e;
+	struct abnf_rule *pr;
+	unsigned long long n = 0, m;
+	for (; pa; pa = pa->next) {
+		for (pc = pa->concatenation; pc; pc = pc->next) {
+			e = &pc->repetition.element;
+			switch (e->type) {
+				case ABNF_ET_RULE:
+					pr = abnf_est_resolve(est, e);
+					m = pr && est->group[pr->internal.index] != group ? abnf_est_rule(est, pr) : 1;
+					break;
+				case ABNF_ET_GROUP:
+					m = abnf_est_alternations(est, e->u.group, group);
+					break;
+				case ABNF_ET_STRING:
+					m = e->u.string.len;
+					break;
+				case ABNF_ET_TOKEN:
+					m = e->u.token.len;
+					break;
+				case ABNF_ET_RANGE:
+					m = 1;
+					break;
+				default:
+					m = 0;
+					break;
+			}
+			/* {n,m} is unrolled to m copies, {n,} to n copies and a loop, * and + to a loop */
+			if (pc->repetition.max == ABNF_INFINITY)
+				m = abnf_est_mul(m, pc->repetition.min > 1 ? pc->repetition.min + 1 : 1);
+			else
+				m = abnf_est_mul(m, pc->repetition.max);
+			n = abnf_est_add(n, m);
+		}
+	}
+	return n;
+}
+
+static unsigned long long abnf_est_rule(struct abnf_estimate *est, struct abnf_rule *pr) {
+	unsigned long long *n = &est->states[pr->internal.index];
+	if (*n == 0) {
+		*n = abnf_est_alternations(est, pr->alternation, est->group[pr->internal.index]);
+		if (*n == 0) *n = 1;
+	}
+	return *n;
+}
+
+struct abnf_rule_estimate {
+	unsigned long long states;
+	struct abnf_rule *pr;
+};
+
+static int abnf_est_cmp(const void *a, const void *b) {
+	const struct abnf_rule_estimate *ea = a, *eb = b;
+	unsigned int la = ea->pr->name.len, lb = eb->pr->name.len;
+	int c;
+	if (ea->states != eb->states)
+		return ea->states < eb->states ? 1 : -1;
+	c = strncasecmp(ea->pr->name.s, eb->pr->name.s, la < lb ? la : lb);
+	if (c) return c;
+	return la < lb ? -1 : la > lb;
+}
+
+int abnf_estimate_states(struct abnf_grammar *g, unsigned long long max_states, unsigned int top) {
+	FILE *stream = abnf_ctx_diag(g->ctx);
+	struct abnf_estimate est;
+	struct abnf_rule_estimate *list;
+	struct abnf_rule *pr;
+	unsigned int n, i;
+	int over = 0, ret;
+
+	for (pr = g->rules, n = 0; pr; pr = pr->next, n++) {
+		pr->internal.index = n;
+	}
+	if (n == 0) return 0;
+	est.g = g;
+	est.sp = est.counter = est.groups = 0;
+	est.states = abnf_malloc(sizeof(*est.states)*n);
+	est.group = abnf_malloc(sizeof(*est.group)*n);
+	est.num = abnf_malloc(sizeof(*est.num)*n);
+	est.stack = abnf_malloc(sizeof(*est.stack)*n);
+	list = abnf_malloc(sizeof(*list)*n);
+	if (!est.states || !est.group || !est.num || !est.stack || !list) {
+		fprintf(stream, "ERROR: not enough memory\n");
+		ret = -1;
+		goto err;
+	}
+	memset(est.states, 0, sizeof(*est.states)*n);
+	memset(est.group, 0, sizeof(*est.group)*n);
+	memset(est.num, 0, sizeof(*est.num)*n);
+	for (pr = g->rules; pr; pr = pr->next) {
+		if (!est.num[pr->internal.index])
+			abnf_est_group_visit(&est, pr);
+	}
+	for (pr = g->rules, i = 0; pr; pr = pr->next, i++) {
+		list[i].states = abnf_est_rule(&est, pr);
+		list[i].pr = pr;
+	}
+	qsort(list, n, sizeof(*list), abnf_est_cmp);
+
+	/* rules over limit are listed even if there are more than top of them */
+	for (i = 0; i < n; i++) {
+		if (max_states && list[i].states > max_states)
+			over++;
+		else if (i >= top)
+			break;
+		if (i == 0)
+			fprintf(stream, "estimated states of largest rules:\n");
+		if (list[i].states == ABNF_STATES_MAX)
+			fprintf(stream, "%12s  %.*s", "overflow", list[i].pr->name.len, list[i].pr->name.s);
+		else
+			fprintf(stream, "%12llu  %.*s", list[i].states, list[i].pr->name.len, list[i].pr->name.s);
+		if (list[i].pr->origin.len)
+			fprintf(stream, " from '%.*s'", list[i].pr->origin.len, list[i].pr->origin.s);
+		fprintf(stream, "%s\n", max_states && list[i].states > max_states ? ", over limit" : "");
+	}
+	if (over)
+		fprintf(stream, "ERROR: %d rules exceed limit of %llu states\n", over, max_states);
+	ret = over;
+err:
+	if (est.states) abnf_free(est.states);
+	if (est.group) abnf_free(est.group);
+	if (est.num) abnf_free(est.num);
+	if (est.stack) abnf_free(est.stack);
+	if (list) abnf_free(list);
+	return ret;
+}
@@ -0,0 +1,388 @@
+/*
+ *  Copyright 2007 by Tomas Mandys <tomas.mandys at 2p dot cz>
+ */
+
+/*  This file is part of abnfc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Ragel; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "abnf.h"
+
+/* rewrites rule tree to smaller equivalent one, nodes stay in pool, removed ones are just unlinked */
+
+#define ABNF_INTERNAL_INLINED 0x20
+#define ABNF_INTERNAL_CLASS   0x40  /* rule is being examined by abnf_char_class */
+
+static void abnf_opt_size(struct abnf_alternation *pa, struct abnf_optimize_size *size) {
+	struct abnf_concatenation *pc;
+	for (; pa; pa = pa->next) {
+		size->alternations++;
+		for (pc = pa->concatenation; pc; pc = pc->next) {
+			size->concatenations++;
+			if (pc->repetition.element.type == ABNF_ET_GROUP)
+				abnf_opt_size(pc->repetition.element.u.group, size);
+		}
+	}
+}
+
+static void abnf_opt_grammar_size(struct abnf_grammar *g, struct abnf_optimize_size *size) {
+	struct abnf_rule *pr;
+	memset(size, 0, sizeof(*size));
+	for (pr = g->rules; pr; pr = pr->next) {
+		size->rules++;
+		abnf_opt_size(pr->alternation, size);
+	}
+}
+
+/* reference count of rule is kept in internal.index which is used by dependency resolution only */
+static void abnf_opt_count_refs(struct abnf_grammar *g, struct abnf_alternation *pa) {
+	struct abnf_concatenation *pc;
+	struct abnf_element *e;
+	for (; pa; pa = pa->next) {
+		for (pc = pa->concatenation; pc; pc = pc->next) {
+			e = &pc->repetition.element;
+			if (e->type == ABNF_ET_RULE) {
+				if (!e->u.rule.resolved)
+					e->u.rule.resolved = abnf_grammar_find_rule(g, e->u.rule.name);
+				if (e->u.rule.resolved)
+					e->u.rule.resolved->internal.index++;
+			}
+			else if (e->type == ABNF_ET_GROUP) {
+				abnf_opt_count_refs(g, e->u.group);
+			}
+		}
+	}
+}
+
+/* rule referenced once is replaced by group, last and start rules are kept because they're Ragel main */
+static void abnf_opt_inline(struct abnf_rule *pr, struct abnf_rule *last, struct abnf_alternation *pa) {
+	struct abnf_concatenation *pc;
+	struct abnf_element *e;
+	struct abnf_rule *pr2;
+	for (; pa; pa = pa->next) {
+		for (pc = pa->concatenation; pc; pc = pc->next) {
+			e = &pc->repetition.element;
+			if (e->type == ABNF_ET_RULE) {
+				pr2 = e->u.rule.resolved;
+				if (!pr2 || pr2 == pr || pr2 == last || pr2->internal.index != 1 || !pr2->alternation ||
+					(pr2->internal.flags & ABNF_INTERNAL_START))
+					continue;
+				pr2->internal.flags |= ABNF_INTERNAL_INLINED;
+				pr2->internal.index = 0;
+				*e = abnf_mk_element_group(pr2->alternation);
+				pr2->alternation = NULL;
+				pr2->internal.last_alternation = NULL;
+			}
+			/* inlined body may reference other single use rules */
+			if (e->type == ABNF_ET_GROUP)
+				abnf_opt_inline(pr, last, e->u.group);
+		}
+	}
+}
+
+/* R(r x) -> n x if repetition counts of both forms are the same */
+static int abnf_opt_combine(struct abnf_repetition *outer, struct abnf_repetition *inner, unsigned int *min, unsigned int *max) {
+	if (ABNF_IS_ONCE(*outer)) {
+		*min = inner->min;
+		*max = inner->max;
+	}
+	else if (ABNF_IS_ONCE(*inner)) {
+		*min = outer->min;
+		*max = outer->max;
+	}
+	else if (outer->max == 0 || inner->max == 0) {
+		return -1;
+	}
+	else if (ABNF_IS_ANY(*inner)) {  /* *(*x), 1*(*x), [*x] */
+		*min = 0;
+		*max = ABNF_INFINITY;
+	}
+	else if (ABNF_IS_MORE(*inner)) {  /* n*(1*x) */
+		*min = outer->min;
+		*max = ABNF_INFINITY;
+	}
+	else if (ABNF_IS_OPTIONAL(*inner)) {  /* n*m[x] */
+		*min = 0;
+		*max = outer->max;
+	}
+	else if (ABNF_IS_OPTIONAL(*outer) && inner->min <= 1) {  /* [n*m x] */
+		*min = 0;
+		*max = inner->max;
+	}
+	else {
+		return -1;
+	}
+	return 0;
+}
+
+static int abnf_opt_equal_alternations(struct abnf_alternation *pa1, struct abnf_alternation *pa2);
+
+/* returns byte matched by one byte string or range, -1 otherwise */
+static int abnf_opt_single_byte(struct abnf_element *e) {
+	if (e->type == ABNF_ET_RANGE && e->u.range.lo == e->u.range.hi)
+		return e->u.range.lo;
+	if (e->type == ABNF_ET_STRING && e->u.string.len == 1)
+		return (unsigned char) e->u.string.s[0];
+	return -1;
+}
+
+static int abnf_opt_equal_element(struct abnf_element *e1, struct abnf_element *e2) {
+	if (e1->type != e2->type)
+		return abnf_opt_single_byte(e1) >= 0 && abnf_opt_single_byte(e1) == abnf_opt_single_byte(e2);
+	switch (e1->type) {
+		case ABNF_ET_RULE:
+			if (e1->u.rule.resolved || e2->u.rule.resolved)
+				return e1->u.rule.resolved == e2->u.rule.resolved;
+			return e1->u.rule.name.len == e2->u.rule.name.len &&
+				strncasecmp(e1->u.rule.name.s, e2->u.rule.name.s, e1->u.rule.name.len) == 0;
+		case ABNF_ET_GROUP:
+			return abnf_opt_equal_alternations(e1->u.group, e2->u.group);
+		case ABNF_ET_STRING:
+			return e1->u.string.len == e2->u.string.len &&
+				memcmp(e1->u.string.s, e2->u.string.s, e1->u.string.len) == 0;
+		case ABNF_ET_TOKEN:
+			return e1->u.token.len == e2->u.token.len &&
+				strncasecmp(e1->u.token.s, e2->u.token.s, e1->u.token.len) == 0;
+		case ABNF_ET_RANGE:
+			return e1->u.range.lo == e2->u.range.lo && e1->u.range.hi == e2->u.range.hi;
+		case ABNF_ET_ACTION:
+			return e1->u.action.action == e2->u.action.action && e1->u.action.user_data == e2->u.action.user_data;
+		default:
+			return 1;
+	}
+}
+
+static int abnf_opt_equal_concatenations(struct abnf_concatenation *pc1, struct abnf_concatenation *pc2) {
+	for (; pc1 && pc2; pc1 = pc1->next, pc2 = pc2->next) {
+		if (pc1->repetition.min != pc2->repetition.min || pc1->repetition.max != pc2->repetition.max ||
+			!abnf_opt_equal_element(&pc1->repetition.element, &pc2->repetition.element))
+			return 0;
+	}
+	return !pc1 && !pc2;
+}
+
+static int abnf_opt_equal_alternations(struct abnf_alternation *pa1, struct abnf_alternation *pa2) {
+	for (; pa1 && pa2; pa1 = pa1->next, pa2 = pa2->next) {
+		if (!abnf_opt_equal_concatenations(pa1->concatenation, pa2->concatenation))
+			return 0;
+	}
+	return !pa1 && !pa2;
+}
+
+static int abnf_opt_char_class(struct abnf_alternation *pa, struct abnf_char_set *cs) {
+	struct abnf_concatenation *pc;
+	struct abnf_element *e;
+	struct abnf_rule *pr;
+	int c, ret;
+	for (; pa; pa = pa->next) {
+		pc = pa->concatenation;
+		if (!pc || pc->next || !ABNF_IS_ONCE(pc->repetition))
+			return 0;
+		e = &pc->repetition.element;
+		switch (e->type) {
+			case ABNF_ET_RANGE:
+				for (c = e->u.range.lo; c <= e->u.range.hi; c++)
+					ABNF_CHAR_SET_ADD(*cs, c);
+				break;
+			case ABNF_ET_STRING:
+				if (e->u.string.len != 1) return 0;
+				ABNF_CHAR_SET_ADD(*cs, e->u.string.s[0]);
+				break;
+			case ABNF_ET_TOKEN:
+				if (e->u.token.len != 1) return 0;
+				c = (unsigned char) e->u.token.s[0];
+				ABNF_CHAR_SET_ADD(*cs, c);
+				if (ABNF_IS_ALPHA(c))
+					ABNF_CHAR_SET_ADD(*cs, c ^ 0x20);
+				break;
+			case ABNF_ET_GROUP:
+				if (!e->u.group || !abnf_opt_char_class(e->u.group, cs))
+					return 0;
+				break;
+			case ABNF_ET_RULE:
+				pr = e->u.rule.resolved;
+				/* recursive rule cannot match exactly one byte */
+				if (!pr || !pr->alternation || (pr->internal.flags & ABNF_INTERNAL_CLASS))
+					return 0;
+				pr->internal.flags |= ABNF_INTERNAL_CLASS;
+				ret = abnf_opt_char_class(pr->alternation, cs);
+				pr->internal.flags &= ~ABNF_INTERNAL_CLASS;
+				if (!ret) return 0;
+				break;
+			default:
+				return 0;
+		}
+	}
+	return 1;
+}
+
+int abnf_char_class(struct abnf_alternation *pa, struct abnf_char_set *cs) {
+	memset(cs, 0, sizeof(*cs));
+	return pa && abnf_opt_char_class(pa, cs);
+}
+
+static char abnf_opt_letters[] = "abcdefghijklmnopqrstuvwxyz";
+
+/* alternatives of one byte are replaced by sorted list of maximal ranges, letter standing
+ * alone in both cases becomes token, referenced rules are expanded so the class is single union */
+static void abnf_opt_fold_class(struct abnf_grammar *g, struct abnf_optimize_info *info, struct abnf_alternation **list) {
+	struct abnf_char_set cs;
+	struct abnf_alternation *pa, *folded = NULL;
+	struct abnf_concatenation *pc;
+	struct abnf_element e;
+	struct abnf_str token;
+	int c, lo;
+
+	if (!*list || !(*list)->next || !abnf_char_class(*list, &cs))
+		return;
+	/* built backwards because items are prepended */
+	for (c = 255; c >= 0; c--) {
+		if (!ABNF_CHAR_SET_HAS(cs, c)) continue;
+		for (lo = c; lo > 0 && ABNF_CHAR_SET_HAS(cs, lo-1); lo--);
+		if (lo < c) {
+			e = abnf_mk_element_range(lo, c);
+			c = lo;
+		}
+		else if (c >= 'a' && c <= 'z' && ABNF_CHAR_SET_HAS(cs, c ^ 0x20) &&
+			!ABNF_CHAR_SET_HAS(cs, (c ^ 0x20) - 1) && !ABNF_CHAR_SET_HAS(cs, (c ^ 0x20) + 1)) {
+			token.s = abnf_opt_letters + (c - 'a');
+			token.len = 1;
+			e = abnf_mk_element_token(token);
+			ABNF_CHAR_SET_DEL(cs, c ^ 0x20);
+		}
+		else {
+			e = abnf_mk_element_char(c);
+		}
+		/* on failure original list stays, partial class is left in pool */
+		pc = abnf_add_concatenation(&g->pool, abnf_mk_once(e), NULL);
+		if (!pc) return;
+		pa = abnf_add_alternation(&g->pool, pc, NULL);
+		if (!pa) return;
+		pa->next = folded;
+		if (folded) folded->prev = pa;
+		folded = pa;
+	}
+	/* complete class replaces list */
+	if (abnf_opt_equal_alternations(*list, folded))
+		return;
+	*list = folded;
+	info->classes++;
+}
+
+static void abnf_opt_alternations(struct abnf_grammar *g, struct abnf_optimize_info *info, struct abnf_alternation **list);
+
+/* flatten groups of a concatenation list, nested lists are optimized first */
+static void abnf_opt_concatenations(struct abnf_grammar *g, struct abnf_optimize_info *info, struct abnf_concatenation **list) {
+	struct abnf_concatenation *pc, *next, *first, *last;
+	struct abnf_alternation *group;
+	unsigned int min, max;
+	for (pc = *list; pc; pc = next) {
+		next = pc->next;
+		if (pc->repetition.element.type != ABNF_ET_GROUP || !pc->repetition.element.u.group)
+			continue;
+		abnf_opt_alternations(g, info, &pc->repetition.element.u.group);
+		group = pc->repetition.element.u.group;
+		if (group->next || !group->concatenation)
+			continue;
+		first = group->concatenation;
+		if (!first->next) {
+			/* single element group, (x) -> x, *(*x) -> *x */
+			if (abnf_opt_combine(&pc->repetition, &first->repetition, &min, &max) == 0) {
+				pc->repetition.element = first->repetition.element;
+				pc->repetition.min = min;
+				pc->repetition.max = max;
+			}
+		}
+		else if (ABNF_IS_ONCE(pc->repetition)) {
+			/* a (b c) d -> a b c d */
+			for (last = first; last->next; last = last->next);
+			first->prev = pc->prev;
+			if (pc->prev)
+				pc->prev->next = first;
+			else
+				*list = first;
+			last->next = pc->next;
+			if (pc->next)
+				pc->next->prev = last;
+		}
+	}
+}
+
+/* alternatives of group standing alone are lifted, duplicate alternatives are removed */
+static void abnf_opt_alternations(struct abnf_grammar *g, struct abnf_optimize_info *info, struct abnf_alternation **list) {
+	struct abnf_alternation *pa, *pa2, *next, *first, *last;
+	struct abnf_concatenation *pc;
+	for (pa = *list; pa; pa = next) {
+		next = pa->next;
+		abnf_opt_concatenations(g, info, &pa->concatenation);
+		pc = pa->concatenation;
+		if (pc && !pc->next && ABNF_IS_ONCE(pc->repetition) &&
+			pc->repetition.element.type == ABNF_ET_GROUP && pc->repetition.element.u.group) {
+			/* a / (b / c) -> a / b / c */
+			first = pc->repetition.element.u.group;
+			for (last = first; last->next; last = last->next);
+			first->prev = pa->prev;
+			if (pa->prev)
+				pa->prev->next = first;
+			else
+				*list = first;
+			last->next = pa->next;
+			if (pa->next)
+				pa->next->prev = last;
+		}
+	}
+	for (pa = *list; pa; pa = pa->next) {
+		for (pa2 = pa->next; pa2; pa2 = next) {
+			next = pa2->next;
+			if (abnf_opt_equal_concatenations(pa->concatenation, pa2->concatenation)) {
+				abnf_remove_list_item(*list, pa2);
+			}
+		}
+	}
+	abnf_opt_fold_class(g, info, list);
+}
+
+int abnf_optimize_rules(struct abnf_grammar *g, struct abnf_optimize_info *info) {
+	struct abnf_rule *pr, *next, *last;
+	memset(info, 0, sizeof(*info));
+	abnf_opt_grammar_size(g, &info->before);
+	last = abnf_grammar_last_rule(g);
+
+	for (pr = g->rules; pr; pr = pr->next) {
+		pr->internal.index = 0;
+		pr->internal.flags &= ~(ABNF_INTERNAL_INLINED|ABNF_INTERNAL_CLASS);
+	}
+	for (pr = g->rules; pr; pr = pr->next) {
+		abnf_opt_count_refs(g, pr->alternation);
+	}
+	for (pr = g->rules; pr; pr = pr->next) {
+		if (pr->internal.flags & ABNF_INTERNAL_INLINED) continue;
+		abnf_opt_inline(pr, last, pr->alternation);
+	}
+	for (pr = g->rules; pr; pr = next) {
+		next = pr->next;
+		if (pr->internal.flags & ABNF_INTERNAL_INLINED) {
+			abnf_grammar_remove_rule(g, pr);
+			info->inlined++;
+			continue;
+		}
+		abnf_opt_alternations(g, info, &pr->alternation);
+		pr->internal.last_alternation = NULL;  /* tail might be removed */
+	}
+
+	abnf_opt_grammar_size(g, &info->after);
+	return 0;
+}
@@ -20,20 +20,21 @@
  */
 
 
+#include <errno.h>
 #include "abnf.h"
 
 %%{
-	# TODO: in case of missing terminating CRLF or a char then final rulename is not processed
-	# the pending action '%' is not called in case that is final action of a machine
-	# to force calling it's necessary to create also final error action '%^' and duplicate code or %/ is enough ???
-	# maybe "write eof" plus EOF state of rulename_scan is not adjusted correctly
+	# pending '%' actions of final rule run only when a char follows, so reader feeds
+	# a LF when input does not end with one, eof is never signalled
+	# scanners clear ts before fret, to-state action of caller does not do it and
+	# streaming reader keeps input from ts
 
 	# write your name
 	machine abnf_reader;
 	alphtype char;
 
 	action all {
-		if (abnf_stop_flag) fbreak;
+		if (abnf_ctx_cancelled(grammar->ctx)) { parse_err = ABNF_PARSE_REPORTED; fbreak; }
 //		DBG("$");
 	}
 
@@ -43,15 +44,16 @@
 		DBG("add_group");
 		top_element.type = ABNF_ET_GROUP;
 		top_element.u.group = NULL;
-		if (alternation_count < ABNF_MAX_ALTERNATION-1) {
+		if (abnf_grow_stacks(&alternation_stack, &stack, &stack_size, alternation_count+1, diag, origin, line) == 0) {
 			DBG_STACK("AG++");
 			alternation_count++;
 			top_stack.top = &pc->repetition.element.u.group;
 			top_stack.prev = NULL;
+			top_stack.last = NULL;
 			top_stack.conc_prev = NULL;
 		}
 		else {
-			fprintf(stderr, "alternation stack overflow\n");
+			parse_err = ABNF_PARSE_REPORTED;
 			fbreak;
 		}
 		fhold;
@@ -60,13 +62,13 @@
 
 	action add_rule {
 		DBG("add_rule");
-		if (alternation_count < ABNF_MAX_ALTERNATION-1) {
+		if (abnf_grow_stacks(&alternation_stack, &stack, &stack_size, alternation_count+1, diag, origin, line) == 0) {
 			struct abnf_rule *pr;
 
 			DBG_STACK("AR++");
 			alternation_count++;
 
-			pr = abnf_find_rule(*rules, last_rulename);
+			pr = abnf_grammar_find_rule(grammar, last_rulename);
 			// fprintf(stderr, "adding rule:'%.*s'\n", last_rulename.len, last_rulename.s);
 			if (!assign_rule_flag) {  /* "=/" */
 				DBG("finding rule");
@@ -74,52 +76,41 @@
 			}
 			else {    /* "=" */
 				if (pr) {
-					fprintf(stderr, "WARNING: overwriting rule '%.*s', comming from '%.*s' by '%.*s'\n",
+					fprintf(diag, "WARNING: overwriting rule '%.*s', comming from '%.*s' by '%.*s'\n",
 						last_rulename.len, last_rulename.s,
 						pr->origin.len, pr->origin.s,
 						origin.len, origin.s);
-					if (pr == last_rule) {
-						last_rule = last_rule->prev;  /* last_rule is != NULL because pr!= NULL, if ->prev nil then no item left */
-					}
-					abnf_remove_list_item(*rules, pr);
-					abnf_destroy_rules(pr);
+					abnf_grammar_remove_rule(grammar, pr);
+					/* rule memory is released together with grammar pool */
 					pr = NULL;  /* "=" */
 				}
 			}
 			if (!pr) {
 				pr = abnf_add_rule(
-					abnf_dupl_str(last_rulename),
+					&grammar->pool,
+					abnf_keep_str(last_rulename),
 					NULL,
 					NULL
 				);
-				if (!pr) fbreak;
+				if (!pr) { parse_err = ABNF_PARSE_NOMEM; fbreak; }
 				if (origin.len) {
-					abnf_rule_assign_origin(pr, NULL, abnf_dupl_str(origin));
+					abnf_rule_assign_origin(pr, NULL, origin);
 				}
-				if (!last_rule) {
-					*rules = pr;
-
-				}
-				else {
-					last_rule->next = pr;
-					pr->prev = last_rule;
+				if (!assign_rule_flag) {
+					/* extends rule of the same name when merged to other grammar */
+					pr->internal.flags |= ABNF_INTERNAL_INCREMENTAL;
 				}
-				last_rule = pr;
+				if (abnf_grammar_append_rules(grammar, pr) < 0) { parse_err = ABNF_PARSE_NOMEM; fbreak; }
 			}
 
 			top_stack.top = &pr->alternation;
-			if (pr->alternation) {
-				for (top_stack.prev = pr->alternation;
-					top_stack.prev->next;
-					top_stack.prev = top_stack.prev->next);
-			}
-			else {
-				top_stack.prev = NULL;
-			}
+			/* "=/" continues after cached tail */
+			top_stack.prev = abnf_rule_last_alternation(pr);
+			top_stack.last = &pr->internal.last_alternation;
 			top_stack.conc_prev = NULL;
 		}
 		else {
-			fprintf(stderr, "alternation stack overflow\n");
+			parse_err = ABNF_PARSE_REPORTED;
 			fbreak;
 		}
 		fhold;
@@ -129,8 +120,8 @@
 	action add_alternation {
 		struct abnf_alternation *pa;
 		DBG("add_alternation");
-		pa = abnf_add_alternation(NULL, NULL);
-		if (!pa) fbreak;
+		pa = abnf_add_alternation(&grammar->pool, NULL, NULL);
+		if (!pa) { parse_err = ABNF_PARSE_NOMEM; fbreak; }
 		if (top_stack.prev == NULL) {
 			*(top_stack.top) = pa;
 		}
@@ -139,6 +130,7 @@
 			pa->prev = top_stack.prev;
 		}
 		top_stack.prev = pa;
+		if (top_stack.last) *top_stack.last = pa;
 		top_stack.conc_prev = NULL;
 	}
 
@@ -147,8 +139,8 @@
 		struct abnf_element r;
 		DBG("add_concatenation");
 		r.type = ABNF_ET_NONE;
-		pc = abnf_add_concatenation(abnf_mk_repetition(r, 1, 1), NULL);
-		if (!pc) fbreak;
+		pc = abnf_add_concatenation(&grammar->pool, abnf_mk_repetition(r, 1, 1), NULL);
+		if (!pc) { parse_err = ABNF_PARSE_NOMEM; fbreak; }
 		if (top_stack.conc_prev == NULL) {
 			top_stack.prev->concatenation = pc;
 		}
@@ -171,25 +163,27 @@
 	}
 
 	action add_char {
+		/* literal grows in pool with doubled capacity so building it is linear, abandoned
+		 * smaller copies are released together with pool */
+		char *lit;
 		if (top_element.type == ABNF_ET_RANGE) {
 			/* change range to string */
-			struct abnf_str s;
-			char buff[2];
-			s.len = sizeof(buff);
-			s.s = buff;
-			buff[0] = top_element.u.range.lo;
-			buff[1] = (char) last_val;
-			top_element = abnf_mk_element_string(abnf_dupl_str(s));
-			if (!top_element.u.string.s) fbreak;
+			lit = abnf_pool_alloc(&grammar->pool, ABNF_LITERAL_CHUNK);
+			if (!lit) { parse_err = ABNF_PARSE_NOMEM; fbreak; }
+			lit[0] = top_element.u.range.lo;
+			top_element = abnf_mk_element_string(abnf_mk_str(NULL));
+			top_element.u.string.s = lit;
+			top_element.u.string.len = 1;
+			literal_size = ABNF_LITERAL_CHUNK;
 		}
-		else {
-			/* prev alloc was sucessfull otherwise called fbreak */
-			char *p;
-			p = abnf_realloc(top_element.u.string.s, top_element.u.string.len+1);
-			if (!p) fbreak;
-			p[top_element.u.string.len++] = last_val;
-			top_element.u.string.s = p;
+		else if (top_element.u.string.len >= literal_size) {
+			lit = abnf_pool_alloc(&grammar->pool, literal_size*2);
+			if (!lit) { parse_err = ABNF_PARSE_NOMEM; fbreak; }
+			memcpy(lit, top_element.u.string.s, top_element.u.string.len);
+			top_element.u.string.s = lit;
+			literal_size *= 2;
 		}
+		top_element.u.string.s[top_element.u.string.len++] = last_val;
 		last_val = 0;
 	}
 
@@ -223,11 +217,14 @@
 			DBG("rulename_scan-A");
 			last_rulename.s = ts;
 			last_rulename.len = te-ts;
+			last_rulename = abnf_token_str(last_rulename);
+			ts = 0;
 			fret;
 		};
 
 		any => {
 			fhold;
+			ts = 0;
 			fret;
 		};
 	*|;
@@ -267,6 +264,7 @@
 			if (*fpc == '\n') line--;
 			fhold; /* set LF as next char */
 			DBG("c_wsp_scan-CRLF");
+			ts = 0;
 			fret;
 		};
 
@@ -274,6 +272,7 @@
 		any => {
 			fhold;
 			DBG("c_wsp_scan-ANY");
+			ts = 0;
 			fret;
 		};
 	*|;
@@ -290,16 +289,19 @@
 			assign_rule_flag = 0;
 			//fhold;
 			DBG("equal_scan-'=/'");
+			ts = 0;
 			fret;
 		};
 		"=" => {
 			assign_rule_flag = 1;
 			//fhold;
 			DBG("equal_scan-'='");
+			ts = 0;
 			fret;
 		};
 		any => {
 			fhold;
+			ts = 0;
 			fret;
 		};
 	*|;
@@ -341,8 +343,8 @@
 	char_val =
 		DQUOTE
 		( 0x20..0x21 | 0x23..0x7e )*
-			>{last_str.s = fpc;}
-			% {last_str.len = fpc-last_str.s;}
+			>{last_str.s = fpc; str_pending = 1;}
+			% {last_str.len = fpc-last_str.s; last_str = abnf_token_str(last_str); str_pending = 0;}
 		DQUOTE;
         char_val_insensitive = ("%i")? %{token_flag = 1;} char_val;
         char_val_sensitive = "%s" %{token_flag = 0;} char_val;
@@ -370,29 +372,29 @@
 	prose_val =
 		"<"
 		( 0x20..0x3d | 0x3f..0x7e )*
-			>{token_flag = 0; last_str.s = fpc;}
-			%{last_str.len = fpc-last_str.s;}
+			>{token_flag = 0; last_str.s = fpc; str_pending = 1;}
+			%{last_str.len = fpc-last_str.s; last_str = abnf_token_str(last_str); str_pending = 0;}
 		">";
 	element =
 		rulename
-			%{top_element = abnf_mk_element_rule(abnf_dupl_str(last_rulename));}
-			%^{top_element = abnf_mk_element_rule(abnf_dupl_str(last_rulename)); DBG("%!rulename");}
-			%/{top_element = abnf_mk_element_rule(abnf_dupl_str(last_rulename)); DBG("%/rulename");}
+			%{top_element = abnf_mk_element_rule(abnf_keep_str(last_rulename));}
+			%^{top_element = abnf_mk_element_rule(abnf_keep_str(last_rulename)); DBG("%!rulename");}
+			%/{top_element = abnf_mk_element_rule(abnf_keep_str(last_rulename)); DBG("%/rulename");}
 		| group
 		| option
 		| char_val_insensitive
-			%{top_element = abnf_mk_element_token(abnf_dupl_str(last_str));}
-			%^{top_element = abnf_mk_element_token(abnf_dupl_str(last_str));DBG("%!charval_insensitive");}
-			%/{top_element = abnf_mk_element_token(abnf_dupl_str(last_str));DBG("%/charval_insensitive");}
+			%{top_element = abnf_mk_element_token(abnf_keep_str(last_str));}
+			%^{top_element = abnf_mk_element_token(abnf_keep_str(last_str));DBG("%!charval_insensitive");}
+			%/{top_element = abnf_mk_element_token(abnf_keep_str(last_str));DBG("%/charval_insensitive");}
                 | char_val_sensitive
-			%{top_element = abnf_mk_element_string(abnf_dupl_str(last_str));}
-			%^{top_element = abnf_mk_element_string(abnf_dupl_str(last_str));DBG("%!charval_sensitive");}
-			%/{top_element = abnf_mk_element_string(abnf_dupl_str(last_str));DBG("%/charval_sensitive");}
+			%{top_element = abnf_mk_element_string(abnf_keep_str(last_str));}
+			%^{top_element = abnf_mk_element_string(abnf_keep_str(last_str));DBG("%!charval_sensitive");}
+			%/{top_element = abnf_mk_element_string(abnf_keep_str(last_str));DBG("%/charval_sensitive");}
 		| num_val
 		| ( prose_val
-			%{top_element = abnf_mk_element_string(abnf_dupl_str(last_str));}
-			%^{top_element = abnf_mk_element_string(abnf_dupl_str(last_str));DBG("%!proseval");}
-			%/{top_element = abnf_mk_element_string(abnf_dupl_str(last_str));DBG("%/proseval");}
+			%{top_element = abnf_mk_element_string(abnf_keep_str(last_str));}
+			%^{top_element = abnf_mk_element_string(abnf_keep_str(last_str));DBG("%!proseval");}
+			%/{top_element = abnf_mk_element_string(abnf_keep_str(last_str));DBG("%/proseval");}
 			)
 		;
 	repetition = ( repeat? element ) >add_concatenation;
@@ -432,15 +434,71 @@
 	main:= rulelist $all;
 }%%
 
-int abnf_parse_abnf(FILE* in_stream, struct abnf_rule** rules, struct abnf_str origin) {
-    #define ABNF_BUFF_CHUNK 1024
-	#define ABNF_MAX_ALTERNATION 50
+/* hard limit of group nesting, stacks grow on demand up to it */
+#ifndef ABNF_MAX_ALTERNATION
+#define ABNF_MAX_ALTERNATION 10000
+#endif
+
+struct abnf_alternation_level {
+	struct abnf_alternation **top;
+	struct abnf_alternation *prev;
+	struct abnf_alternation **last;  /* tail cache of rule, NULL for group */
+	struct abnf_concatenation *conc_prev;
+};
+
+/* ragel call stack is at most two levels deeper than alternation stack (scanners
+ * called from main and from the innermost alternation), so both stacks grow together
+ * before each fcall alternation, sizes are doubled to keep reallocation amortized */
+static int abnf_grow_stacks(struct abnf_alternation_level **levels, int **stack, unsigned int *size, unsigned int count, FILE *diag, struct abnf_str origin, unsigned int line) {
+	struct abnf_alternation_level *l;
+	int *st;
+	unsigned int n;
+
+	if (count + 2 <= *size) return 0;
+	if (count > ABNF_MAX_ALTERNATION) {
+		fprintf(diag, "ERROR: origin:'%.*s', line: %u, groups nested deeper than %u\n", origin.len, origin.s, line, ABNF_MAX_ALTERNATION);
+		return -1;
+	}
+	for (n = *size?*size:16; n < count + 2; n *= 2);
+	if (n > ABNF_MAX_ALTERNATION + 2) n = ABNF_MAX_ALTERNATION + 2;
+	l = abnf_realloc(*levels, sizeof(**levels)*n);
+	if (!l) goto err;
+	*levels = l;
+	st = abnf_realloc(*stack, sizeof(**stack)*n);
+	if (!st) goto err;
+	*stack = st;
+	*size = n;
+	return 0;
+err:
+	fprintf(diag, "ERROR: not enough memory for alternation stack\n");
+	return -1;
+}
+
+int abnf_parse_abnf(FILE* in_stream, struct abnf_grammar *grammar, struct abnf_str origin) {
+	struct abnf_buffer in_buff;
+
+	if (abnf_map_stream(in_stream, &in_buff) < 0) return -1;
+	return abnf_parse_abnf_mapped(in_stream, &in_buff, grammar, origin);
+}
+
+int abnf_parse_abnf_mapped(FILE* in_stream, struct abnf_buffer *mapped_buff, struct abnf_grammar *grammar, struct abnf_str origin) {
 	#define MAX_ERR_LIST_LEN 200
+	#define ABNF_LITERAL_CHUNK 16
 	#define top_stack alternation_stack[alternation_count-1]
 	#define top_element top_stack.conc_prev->repetition.element
 	#define DBG(_s_) { \
 	/*	fprintf(stderr, "%s: #%d: cs: %d, top: %d: st+0:%d, st-1:%d, tok:%d, line: %d, (%d): '%.10s'\n", (_s_), __LINE__, cs, top, stack[top], top>0?stack[top-1]:-1, tokend-tokstart, line, *p, p); */ \
 	}
+	#ifndef ABNF_STREAM_CHUNK
+	#define ABNF_STREAM_CHUNK 65536
+	#endif
+	/* fbreak advances p so it cannot be told from end of chunk, failing actions set parse_err */
+	#define ABNF_PARSE_NOMEM 1
+	#define ABNF_PARSE_REPORTED 2  /* or cancelled */
+	/* in zero copy mode string points to input buffer, when streaming token is copied as soon
+	 * as it is complete because buffer is reused */
+	#define abnf_keep_str(_s_) (((grammar->flags & ABNF_GRAMMAR_ZERO_COPY) || streaming)?(_s_):abnf_pool_dupl_str(&grammar->pool, (_s_)))
+	#define abnf_token_str(_s_) (streaming?abnf_pool_dupl_str(&grammar->pool, (_s_)):(_s_))
 	#define DBG_STACK(_s_) { \
 	/*	fprintf(stderr, "%s:%d  line: %d, '%.10s'\n", (_s_), alternation_count, line, p); */ \
 	}
@@ -448,68 +506,158 @@ int abnf_parse_abnf(FILE* in_stream, struct abnf_rule** rules, struct abnf_str o
 	%% write data noerror;
 
 	char *p, *pe, *buff, *ts, *te, *eof;
-	int cs, top, stack[50], act;
+	int cs, top, *stack = NULL, act;
 	struct abnf_str last_rulename, last_str;
 	unsigned int last_val, last_val_mult;
-	int assign_rule_flag, token_flag, val_flag;
-	struct abnf_rule *last_rule = NULL;
+	size_t literal_size = 0;  /* capacity of dotted literal being built */
+	int assign_rule_flag, token_flag, val_flag, str_pending;
 	unsigned int line;
-	struct {
-		struct abnf_alternation **top;
-		struct abnf_alternation *prev;
-		struct abnf_concatenation *conc_prev;
-	} alternation_stack[ABNF_MAX_ALTERNATION];
-	unsigned int alternation_count = 0;
-
-	size_t i, n;
-
-	/* read file into buffer */
-	buff = NULL;
-	n = 0;
-	do {
-		p = abnf_realloc(buff, n + ABNF_BUFF_CHUNK);
-		if (!p) {
-			if (buff) abnf_free(buff);
+	struct abnf_alternation_level *alternation_stack = NULL;
+	unsigned int alternation_count = 0, stack_size = 0;
+
+	size_t i, n, have, buff_size, consumed;
+	struct abnf_buffer in_buff = *mapped_buff;
+	int streaming, ret, parse_err = 0, nl_pass = 0;
+	char last_c = '\n';
+	char *keep, *new_buff;
+	FILE *diag = abnf_ctx_diag(grammar->ctx);
+
+	mapped_buff->s = NULL;  /* taken over */
+	/* missing final LF is appended, mapping is read only so such file is streamed */
+	if (in_buff.mapped && in_buff.s[in_buff.len-1] != '\n') {
+		abnf_release_buffer(&in_buff);
+		in_buff.mapped = 0;
+	}
+	streaming = !in_buff.mapped;
+	if (streaming) {
+		/* pipe, memory is bounded by chunk size or longest token */
+		buff_size = ABNF_STREAM_CHUNK;
+		buff = abnf_malloc(buff_size);
+		if (!buff) return -1;
+		n = 0;
+	}
+	else {
+		buff = in_buff.s;
+		n = in_buff.len;
+		/* rules will reference buffer */
+		if ((grammar->flags & ABNF_GRAMMAR_ZERO_COPY) && abnf_grammar_keep_buffer(grammar, buff, n, in_buff.mapped) < 0) {
+			abnf_release_buffer(&in_buff);
 			return -1;
 		}
-		buff = p;
-		i = fread(buff+n, sizeof(*buff), ABNF_BUFF_CHUNK, in_stream);
-		n += i;
-	} while (i == ABNF_BUFF_CHUNK);
-	/* ABNF defines line ends as CRLF so adjust CR / LF */
-	pe = buff + n;
-	p = buff;
+	}
 
 	%% write init;
 	line = 1;
+	/* eof is never signalled, final state is checked when input is exhausted */
+	eof = NULL;
 	/* unwarnings */
-	assign_rule_flag = token_flag = val_flag = 0;
+	assign_rule_flag = token_flag = val_flag = str_pending = 0;
 	last_val = last_val_mult = 0;
 	last_rulename.s = last_str.s = 0;
 	last_rulename.len = last_str.len = 0;
+	last_rulename.flags = last_str.flags = 0;
 	i = abnf_reader_en_rulename_scan;
 	i = abnf_reader_en_c_wsp_scan;
 	i = abnf_reader_en_equal_scan;
 	i = abnf_reader_en_alternation;
 	i = abnf_reader_en_main;
 
-	for (last_rule = *rules; last_rule && last_rule->next; last_rule=last_rule->next);
+	if (origin.len) {
+		origin = abnf_pool_dupl_str(&grammar->pool, origin);
+	}
+	ret = -1;
+	/* main machine calls scanners before first rule */
+	if (abnf_grow_stacks(&alternation_stack, &stack, &stack_size, 0, diag, origin, line) < 0)
+		goto err;
+
+	have = consumed = 0;
+	p = pe = buff;
+	while (1) {
+		if (streaming) {
+			if (have == buff_size) {
+				/* token does not fit, old buffer is kept until pointers are rebased */
+				new_buff = abnf_malloc(buff_size*2);
+				if (!new_buff) {
+					fprintf(diag, "ERROR: origin:'%.*s', line: %u, not enough memory for token\n", origin.len, origin.s, line);
+					goto err;
+				}
+				if (ts) {
+					te = new_buff + (te - buff);
+					ts = new_buff + (ts - buff);
+				}
+				if (str_pending) last_str.s = new_buff + (last_str.s - buff);
+				memcpy(new_buff, buff, have);
+				abnf_free(buff);
+				buff = new_buff;
+				buff_size *= 2;
+			}
+			n = fread(buff+have, 1, buff_size-have, in_stream);
+			if (n == 0) {
+				if (ferror(in_stream)) {
+					fprintf(diag, "ERROR: origin:'%.*s', read error (errno:%d)\n", origin.len, origin.s, errno);
+					goto err;
+				}
+				if (last_c == '\n') break;
+				/* final rule is completed by LF, buffer has room as it is grown when full */
+				buff[have] = '\n';
+				n = 1;
+				nl_pass = 1;
+			}
+			p = buff + have;
+			pe = p + n;
+			last_c = pe[-1];
+		}
+		else {
+			p = buff;
+			pe = buff + n;
+		}
 
-	%% write exec;
+		%% write exec;
+
+		if (!streaming || nl_pass || parse_err || p != pe || abnf_ctx_cancelled(grammar->ctx))  /* error or fbreak */
+			break;
+		/* move started tokens to the beginning of buffer */
+		keep = ts;
+		if (str_pending && (!keep || last_str.s < keep)) keep = last_str.s;
+		if (!keep) keep = pe;
+		have = pe - keep;
+		consumed += keep - buff;
+		if (have) memmove(buff, keep, have);
+		if (ts) {
+			te = buff + (te - keep);
+			ts = buff + (ts - keep);
+		}
+		if (str_pending) last_str.s = buff + (last_str.s - keep);
+		p = pe = buff + have;
+	}
 
+	if (parse_err) {
+		if (parse_err == ABNF_PARSE_NOMEM)
+			fprintf(diag, "ERROR: origin:'%.*s', line: %u, not enough memory for rules\n", origin.len, origin.s, line);
+		goto err;
+	}
 	if (cs < abnf_reader_first_final) {
-		fprintf(stderr, "origin:'%.*s', line: %u, cs: %d, rule parsing error at %d\n", origin.len, origin.s, line, cs, p-buff);
+		fprintf(diag, "origin:'%.*s', line: %u, cs: %d, rule parsing error at %lu\n", origin.len, origin.s, line, cs, (unsigned long) (consumed + (p-buff)));
 		if (pe-p<=MAX_ERR_LIST_LEN) {
-			fprintf(stderr, "%.*s\n", pe-p, p);
+			fprintf(diag, "%.*s\n", (int) (pe-p), p);
 		}
 		else {
-			fprintf(stderr, "%.*s\n.......and %d chars continue\n", MAX_ERR_LIST_LEN, p, pe-p-MAX_ERR_LIST_LEN);
+			fprintf(diag, "%.*s\n.......and %d chars continue\n", MAX_ERR_LIST_LEN, p, (int) (pe-p-MAX_ERR_LIST_LEN));
 		}
 	}
 	else if (alternation_count > 1) {  /* BUG?: it should be zero but it's permanently 1 */
-		fprintf(stderr, "stack is not empty, ac: %d, top: %d, cs: %d\n", alternation_count, top, cs);
+		fprintf(diag, "stack is not empty, ac: %d, top: %d, cs: %d\n", alternation_count, top, cs);
 	}
-	abnf_free(buff);
+	ret = cs < abnf_reader_first_final ? 1 : 0;
+err:
+	if (streaming) {
+		abnf_free(buff);
+	}
+	else if ((grammar->flags & ABNF_GRAMMAR_ZERO_COPY) == 0) {
+		abnf_release_buffer(&in_buff);
+	}
+	if (alternation_stack) abnf_free(alternation_stack);
+	if (stack) abnf_free(stack);
 
-	return 0;
+	return ret;
 }
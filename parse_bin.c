@@ -0,0 +1,286 @@
+/*
+ *  Copyright 2007 by Tomas Mandys <tomas.mandys at 2p dot cz>
+ */
+
+/*  This file is part of abnfc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Ragel; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "abnf.h"
+
+/* import of binary rule list written by abnf_print_bin_rules or of static tables written
+ * by abnf_print_self_rules, nodes are allocated as three arrays, rule index is taken from
+ * stored hash buckets and strings point to input buffer in zero copy mode
+ */
+struct abnf_bin_loader {
+	struct abnf_grammar *grammar;
+	char *strings;
+	uint32_t string_size;
+	struct abnf_alternation *alternations;
+	struct abnf_concatenation *concatenations;
+	uint32_t alternation_count, concatenation_count;
+	unsigned char *used;  /* each node may be referenced once */
+	int static_strings;
+};
+
+static int abnf_bin_get_str(struct abnf_bin_loader *ld, uint32_t ofs, uint32_t len, struct abnf_str *s) {
+	s->flags = 0;
+	if ((uint64_t) ofs + len > ld->string_size) return -1;
+	s->s = ld->strings + ofs;
+	s->len = len;
+	if (len && !ld->static_strings && (ld->grammar->flags & ABNF_GRAMMAR_ZERO_COPY) == 0) {
+		*s = abnf_pool_dupl_str(&ld->grammar->pool, *s);
+		if (!s->s) return -1;
+	}
+	return 0;
+}
+
+/* index+1 of node referenced by owner which must be lower if owner is the same kind of node */
+static int abnf_bin_use_alternation(struct abnf_bin_loader *ld, uint32_t idx, uint32_t owner, struct abnf_alternation **pa) {
+	*pa = NULL;
+	if (!idx) return 0;
+	if (idx > ld->alternation_count || idx <= owner || ld->used[idx-1]) return -1;
+	ld->used[idx-1] = 1;
+	*pa = &ld->alternations[idx-1];
+	return 0;
+}
+
+static int abnf_bin_use_concatenation(struct abnf_bin_loader *ld, uint32_t idx, uint32_t owner, struct abnf_concatenation **pc) {
+	*pc = NULL;
+	if (!idx) return 0;
+	if (idx > ld->concatenation_count || idx <= owner || ld->used[ld->alternation_count+idx-1]) return -1;
+	ld->used[ld->alternation_count+idx-1] = 1;
+	*pc = &ld->concatenations[idx-1];
+	return 0;
+}
+
+int abnf_load_bin_tables(struct abnf_grammar *g, const struct abnf_bin_tables *t, struct abnf_str origin, int static_strings) {
+	const struct abnf_bin_rule *br;
+	const struct abnf_bin_alternation *ba;
+	const struct abnf_bin_concatenation *bc;
+	struct abnf_bin_loader ld;
+	struct abnf_rule *rules, *pr;
+	struct abnf_alternation *pa;
+	struct abnf_concatenation *pc;
+	struct abnf_element *e;
+	uint32_t i, j;
+	int ret = -1;
+
+	br = t->rules;
+	ba = t->alternations;
+	bc = t->concatenations;
+	memset(&ld, 0, sizeof(ld));
+	ld.grammar = g;
+	ld.strings = (char *) t->strings;
+	ld.string_size = t->string_size;
+	ld.static_strings = static_strings;
+	ld.alternation_count = t->alternation_count;
+	ld.concatenation_count = t->concatenation_count;
+	rules = NULL;
+	if (t->rule_count)
+		rules = abnf_pool_alloc(&g->pool, sizeof(*rules)*t->rule_count);
+	if (ld.alternation_count)
+		ld.alternations = abnf_pool_alloc(&g->pool, sizeof(*ld.alternations)*ld.alternation_count);
+	if (ld.concatenation_count)
+		ld.concatenations = abnf_pool_alloc(&g->pool, sizeof(*ld.concatenations)*ld.concatenation_count);
+	ld.used = abnf_malloc(ld.alternation_count + ld.concatenation_count + 1);
+	if ((t->rule_count && !rules) || (ld.alternation_count && !ld.alternations) ||
+		(ld.concatenation_count && !ld.concatenations) || !ld.used) {
+		fprintf(abnf_ctx_diag(g->ctx), "ERROR: not enough memory for binary rule list\n");
+		goto err;
+	}
+	memset(ld.used, 0, ld.alternation_count + ld.concatenation_count);
+	if (ld.alternation_count)
+		memset(ld.alternations, 0, sizeof(*ld.alternations)*ld.alternation_count);
+	if (ld.concatenation_count)
+		memset(ld.concatenations, 0, sizeof(*ld.concatenations)*ld.concatenation_count);
+	if (origin.len) {
+		origin = abnf_pool_dupl_str(&g->pool, origin);
+	}
+
+	/* pointer fix-up */
+	for (i = 0; i < ld.alternation_count; i++) {
+		pa = &ld.alternations[i];
+		if (abnf_bin_use_concatenation(&ld, ba[i].concatenation, 0, &pa->concatenation) < 0 ||
+			abnf_bin_use_alternation(&ld, ba[i].next, i+1, &pa->next) < 0)
+			goto err_format;
+		for (pc = pa->concatenation, j = ba[i].concatenation; pc; pc = pc->next, j = bc[j-1].next) {
+			/* conc chain of alternation i+1, nested group must have higher index */
+			pc->repetition.min = bc[j-1].min;
+			pc->repetition.max = bc[j-1].max;
+			e = &pc->repetition.element;
+			e->type = bc[j-1].type;
+			switch (e->type) {
+				case ABNF_ET_RULE:
+					e->u.rule.resolved = NULL;
+					if (abnf_bin_get_str(&ld, bc[j-1].a, bc[j-1].b, &e->u.rule.name) < 0)
+						goto err_format;
+					break;
+				case ABNF_ET_STRING:
+				case ABNF_ET_TOKEN:
+					if (abnf_bin_get_str(&ld, bc[j-1].a, bc[j-1].b, &e->u.string) < 0)
+						goto err_format;
+					break;
+				case ABNF_ET_RANGE:
+					if (bc[j-1].a > 0xff || bc[j-1].b > 0xff)
+						goto err_format;
+					e->u.range.lo = bc[j-1].a;
+					e->u.range.hi = bc[j-1].b;
+					break;
+				case ABNF_ET_GROUP:
+					if (abnf_bin_use_alternation(&ld, bc[j-1].a, i+1, &e->u.group) < 0)
+						goto err_format;
+					break;
+				case ABNF_ET_NONE:
+					break;
+				default:
+					goto err_format;
+			}
+			if (abnf_bin_use_concatenation(&ld, bc[j-1].next, j, &pc->next) < 0)
+				goto err_format;
+			if (pc->next) pc->next->prev = pc;
+		}
+		if (pa->next) pa->next->prev = pa;
+	}
+
+	for (i = 0; i < t->rule_count; i++) {
+		pr = &rules[i];
+		memset(&pr->internal, 0, sizeof(pr->internal));
+		if (abnf_bin_get_str(&ld, br[i].name, br[i].name_len, &pr->name) < 0)
+			goto err_format;
+		if (origin.len) {
+			pr->origin = origin;
+		}
+		else if (abnf_bin_get_str(&ld, br[i].origin, br[i].origin_len, &pr->origin) < 0)
+			goto err_format;
+		pr->internal.flags = br[i].flags & ABNF_INTERNAL_INCREMENTAL;
+		if (abnf_bin_use_alternation(&ld, br[i].alternation, 0, &pr->alternation) < 0)
+			goto err_format;
+		pr->prev = i > 0 ? &rules[i-1] : NULL;
+		pr->next = i+1 < t->rule_count ? &rules[i+1] : NULL;
+	}
+	if (!t->index_size || g->rules) {
+		if (abnf_grammar_append_rules(g, rules) < 0)
+			goto err;
+		ret = 0;
+		goto err;
+	}
+
+	/* rule index, chains must be in list order and contain each rule once */
+	if ((t->index_size & (t->index_size-1)) != 0)
+		goto err_format;
+	g->index = abnf_ctx_alloc(g->ctx, sizeof(*g->index)*t->index_size);
+	if (!g->index) {
+		fprintf(abnf_ctx_diag(g->ctx), "ERROR: not enough memory for binary rule list\n");
+		goto err;
+	}
+	g->index_size = t->index_size;
+	g->index_count = 0;
+	for (i = 0; i < t->index_size; i++) {
+		g->index[i] = NULL;
+		for (j = t->index[i], pr = NULL; j; j = br[j-1].hash_next) {
+			if (j > t->rule_count || (pr && j <= pr - rules + 1) || (br[j-1].hash & (t->index_size-1)) != i)
+				goto err_index;
+			if (pr)
+				pr->internal.hash_next = &rules[j-1];
+			else
+				g->index[i] = &rules[j-1];
+			pr = &rules[j-1];
+			pr->internal.hash = br[j-1].hash;
+			g->index_count++;
+		}
+	}
+	if (g->index_count != t->rule_count)
+		goto err_index;
+	g->rules = rules;
+	g->last_rule = &rules[t->rule_count-1];
+	ret = 0;
+	goto err;
+
+err_index:
+	abnf_ctx_release(g->ctx, g->index);
+	g->index = NULL;
+	g->index_size = g->index_count = 0;
+
+err_format:
+	fprintf(abnf_ctx_diag(g->ctx), "ERROR: binary rule list is corrupted\n");
+err:
+	if (ld.used) abnf_free(ld.used);
+	return ret;
+}
+
+static int abnf_load_bin(struct abnf_grammar *g, char *buff, size_t len, struct abnf_str origin) {
+	struct abnf_bin_header *hdr;
+	struct abnf_bin_tables t;
+	uint64_t size;
+
+	hdr = (struct abnf_bin_header *) buff;
+	if (len < sizeof(*hdr) || memcmp(hdr->magic, ABNF_BIN_MAGIC, sizeof(hdr->magic)) != 0 ||
+		hdr->bom != ABNF_BIN_BOM || hdr->format != ABNF_BIN_FORMAT) {
+		fprintf(abnf_ctx_diag(g->ctx), "ERROR: not a binary rule list of format %u\n", ABNF_BIN_FORMAT);
+		return -1;
+	}
+	size = sizeof(*hdr) +
+		(uint64_t) hdr->rule_count * sizeof(*t.rules) +
+		(uint64_t) hdr->alternation_count * sizeof(*t.alternations) +
+		(uint64_t) hdr->concatenation_count * sizeof(*t.concatenations) +
+		(uint64_t) hdr->index_size * sizeof(*t.index) +
+		hdr->string_size;
+	if (size > len) {
+		fprintf(abnf_ctx_diag(g->ctx), "ERROR: binary rule list is truncated\n");
+		return -1;
+	}
+	t.rule_count = hdr->rule_count;
+	t.alternation_count = hdr->alternation_count;
+	t.concatenation_count = hdr->concatenation_count;
+	t.index_size = hdr->index_size;
+	t.string_size = hdr->string_size;
+	t.rules = (struct abnf_bin_rule *) (hdr + 1);
+	t.alternations = (struct abnf_bin_alternation *) (t.rules + t.rule_count);
+	t.concatenations = (struct abnf_bin_concatenation *) (t.alternations + t.alternation_count);
+	t.index = (uint32_t *) (t.concatenations + t.concatenation_count);
+	t.strings = (char *) (t.index + t.index_size);
+	return abnf_load_bin_tables(g, &t, origin, 0);
+}
+
+int abnf_parse_bin_buffer(struct abnf_buffer *in_buff, struct abnf_grammar *grammar, struct abnf_str origin) {
+	struct abnf_grammar g;
+	int ret;
+
+	abnf_init_grammar_ctx(&g, grammar->ctx);
+	g.flags = grammar->flags;
+	/* rules will reference buffer */
+	if ((g.flags & ABNF_GRAMMAR_ZERO_COPY) && abnf_grammar_keep_buffer(&g, in_buff->s, in_buff->len, in_buff->mapped) < 0) {
+		abnf_release_buffer(in_buff);
+		return -1;
+	}
+	ret = abnf_load_bin(&g, in_buff->s, in_buff->len, origin);
+	if (ret == 0) {
+		ret = abnf_grammar_merge(grammar, &g);
+	}
+	abnf_destroy_grammar(&g);
+	if ((grammar->flags & ABNF_GRAMMAR_ZERO_COPY) == 0) {
+		abnf_release_buffer(in_buff);
+	}
+	return ret;
+}
+
+int abnf_parse_bin(FILE* in_stream, struct abnf_grammar *grammar, struct abnf_str origin) {
+	struct abnf_buffer in_buff;
+
+	if (abnf_read_stream(in_stream, &in_buff) < 0) return -1;
+	return abnf_parse_bin_buffer(&in_buff, grammar, origin);
+}
@@ -22,42 +22,36 @@
 #include "abnf.h"
 
 /* export to ABNF */
-inline static void abnf_print_rep_char(FILE *stream, char c, int n) {
-	for (; n > 0; n--) {
-		fprintf(stream, "%c", c);
-	}
-}
-
-static void abnf_print_abnf_element(FILE *stream, struct abnf_element *e, int already_in_group);
-static void abnf_print_abnf_alternations(FILE *stream, struct abnf_alternation *pa) {
+static void abnf_print_abnf_element(struct abnf_writer *w, struct abnf_element *e, int already_in_group);
+static void abnf_print_abnf_alternations(struct abnf_writer *w, struct abnf_alternation *pa) {
 	struct abnf_concatenation *pc;
 	int ia, na, ic, nc;
 	na = abnf_alternation_count(pa);
 	for (ia = 0; pa; pa = pa->next, ia++) {
-		if (ia > 0) fprintf(stream, " / ");
+		if (ia > 0) abnf_write(w, " / ", 3);
 		nc = abnf_concatenation_count(pa->concatenation);
-		if (na > 1 && nc > 1) fprintf(stream, "( ");
+		if (na > 1 && nc > 1) abnf_write(w, "( ", 2);
 		for (ic = 0, pc = pa->concatenation; pc; ic++, pc = pc->next) {
-			if (ic > 0) fprintf(stream, " ");
+			if (ic > 0) abnf_write_char(w, ' ');
 			if (ABNF_IS_OPTIONAL(pc->repetition))
-				fprintf(stream, "[ ");
+				abnf_write(w, "[ ", 2);
 			else if (!ABNF_IS_ONCE(pc->repetition)) {
-				if (pc->repetition.min > 0) fprintf(stream, "%u", pc->repetition.min);
-				fprintf(stream, "*");
-				if (pc->repetition.max != ABNF_INFINITY) fprintf(stream, "%u", pc->repetition.max);
+				if (pc->repetition.min > 0) abnf_write_uint(w, pc->repetition.min);
+				abnf_write_char(w, '*');
+				if (pc->repetition.max != ABNF_INFINITY) abnf_write_uint(w, pc->repetition.max);
 			}
-			abnf_print_abnf_element(stream, &pc->repetition.element, ABNF_IS_OPTIONAL(pc->repetition));
-			if (ABNF_IS_OPTIONAL(pc->repetition)) fprintf(stream, " ]");
+			abnf_print_abnf_element(w, &pc->repetition.element, ABNF_IS_OPTIONAL(pc->repetition));
+			if (ABNF_IS_OPTIONAL(pc->repetition)) abnf_write(w, " ]", 2);
 		}
-		if (na > 1 && nc > 1) fprintf(stream, " )");
+		if (na > 1 && nc > 1) abnf_write(w, " )", 2);
 	}
 }
 
-static void abnf_print_abnf_element(FILE *stream, struct abnf_element *e, int already_in_group) {
+static void abnf_print_abnf_element(struct abnf_writer *w, struct abnf_element *e, int already_in_group) {
 	int i, j, n, na, nc;
 	switch (e->type) {
 		case ABNF_ET_RULE:
-			fprintf(stream, "%.*s", e->u.rule.name.len, e->u.rule.name.s);
+			abnf_write_str(w, e->u.rule.name);
 			break;
 		case ABNF_ET_GROUP:
 			na = abnf_alternation_count(e->u.group);
@@ -65,27 +59,34 @@ static void abnf_print_abnf_element(FILE *stream, struct abnf_element *e, int al
 				nc = abnf_concatenation_count(e->u.group->concatenation);
 			else
 				nc = 0;
-			if (!already_in_group && (na > 1 || (na == 1 && nc > 1))) fprintf(stream, "( "); /* abnf_print_abnf_alternation won't add parenthesis */
-				abnf_print_abnf_alternations(stream, e->u.group);
-			if (!already_in_group && (na > 1 || (na == 1 && nc > 1))) fprintf(stream, " )"); /* abnf_print_abnf_alternation won't add parenthesis */
+			if (!already_in_group && (na > 1 || (na == 1 && nc > 1))) abnf_write(w, "( ", 2); /* abnf_print_abnf_alternation won't add parenthesis */
+				abnf_print_abnf_alternations(w, e->u.group);
+			if (!already_in_group && (na > 1 || (na == 1 && nc > 1))) abnf_write(w, " )", 2); /* abnf_print_abnf_alternation won't add parenthesis */
 			break;
 		case ABNF_ET_RANGE:
 			if (e->u.range.lo == e->u.range.hi) {
 				if (ABNF_IS_ALPHA(e->u.range.lo) || !ABNF_IS_VALID_TOKEN_CHAR(e->u.range.lo) ) {
-					fprintf(stream, "%%x%.2x", e->u.range.lo);
+					abnf_write(w, "%x", 2);
+					abnf_write_hex(w, e->u.range.lo);
+				}
+				else {
+					abnf_write_char(w, '"');
+					abnf_write_char(w, e->u.range.lo);
+					abnf_write_char(w, '"');
 				}
-				else
-					fprintf(stream, "\"%c\"", e->u.range.lo);
 			}
 			else {
-					fprintf(stream, "%%x%.2x-%.2x", e->u.range.lo, e->u.range.hi);
+					abnf_write(w, "%x", 2);
+					abnf_write_hex(w, e->u.range.lo);
+					abnf_write_char(w, '-');
+					abnf_write_hex(w, e->u.range.hi);
 			}
 			break;
 		case ABNF_ET_STRING:
-			fprintf(stream, "%%x");
+			abnf_write(w, "%x", 2);
 			for (i=0; i < e->u.string.len; i++) {
-				if (i > 0) fprintf(stream, ".");
-				fprintf(stream, "%.2x", (unsigned char) e->u.string.s[i]);
+				if (i > 0) abnf_write_char(w, '.');
+				abnf_write_hex(w, e->u.string.s[i]);
 			}
 			break;
 		case ABNF_ET_TOKEN:
@@ -97,23 +98,25 @@ static void abnf_print_abnf_element(FILE *stream, struct abnf_element *e, int al
 					for (i++; i < e->u.token.len && !ABNF_IS_VALID_TOKEN_CHAR(e->u.token.s[i]); i++);
 				}
 			}
-			if (n > 1) fprintf(stream, "( ");
+			if (n > 1) abnf_write(w, "( ", 2);
 			for (i=0; i < e->u.token.len; ) {
-				if (i > 0) fprintf(stream, " ");
+				if (i > 0) abnf_write_char(w, ' ');
 				j = i;
 				if (ABNF_IS_VALID_TOKEN_CHAR(e->u.token.s[i])) {
 					for (i++; i < e->u.token.len && ABNF_IS_VALID_TOKEN_CHAR(e->u.token.s[i]); i++);
-					fprintf(stream, "\"%.*s\"", i-j, e->u.token.s + j);
+					abnf_write_char(w, '"');
+					abnf_write(w, e->u.token.s + j, i-j);
+					abnf_write_char(w, '"');
 				}
 				else {
-					fprintf(stream, "%%x");
+					abnf_write(w, "%x", 2);
 					for (i++; i < e->u.token.len && !ABNF_IS_VALID_TOKEN_CHAR(e->u.token.s[i]); i++) {
-						if (i > j) fprintf(stream, ".");
-						fprintf(stream, "%.2x", (unsigned char) e->u.token.s[i]);
+						if (i > j) abnf_write_char(w, '.');
+						abnf_write_hex(w, e->u.token.s[i]);
 					}
 				}
 			}
-			if (n > 1) fprintf(stream, " )");
+			if (n > 1) abnf_write(w, " )", 2);
 			break;
 
 		default:
@@ -125,18 +128,27 @@ void abnf_print_abnf_rules(FILE *stream, struct abnf_rule *rules, struct abnf_pr
 	int max_rule_len;
 	struct abnf_rule *pr;
 	struct abnf_print_comment comment_def = {.pre_comment = NULL, .line_comment = "; ", .post_comment = NULL};
+	struct abnf_writer *w;
 
 	abnf_print_header(stream, info, &comment_def);
+	w = abnf_malloc(sizeof(*w));
+	if (!w) {
+		fprintf(stderr, "ERROR: not enough memory for output buffer\n");
+		return;
+	}
+	abnf_writer_init(w, stream);
 
 	for (pr = rules, max_rule_len = 0; pr; pr = pr->next) {
 		if (pr->name.len > max_rule_len)
 			max_rule_len = pr->name.len;
 	}
 	for (pr = rules; pr; pr = pr->next) {
-		fprintf(stream, "%.*s", pr->name.len, pr->name.s);
-		abnf_print_rep_char(stream, ' ', max_rule_len-pr->name.len);
-		fprintf(stream, " = ");
-		abnf_print_abnf_alternations(stream, pr->alternation);
-		fprintf(stream, "\n");
+		abnf_write_str(w, pr->name);
+		abnf_write_rep_char(w, ' ', max_rule_len-pr->name.len);
+		abnf_write(w, " = ", 3);
+		abnf_print_abnf_alternations(w, pr->alternation);
+		abnf_write_char(w, '\n');
 	}
+	abnf_writer_flush(w);
+	abnf_free(w);
 }
@@ -0,0 +1,238 @@
+/*
+ *  Copyright 2007 by Tomas Mandys <tomas.mandys at 2p dot cz>
+ */
+
+/*  This file is part of abnfc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  It is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with Ragel; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "abnf.h"
+
+/* export to binary rule list, see struct abnf_bin_header, tables are shared
+ * with abnf_print_self_rules
+ */
+struct abnf_bin_table {
+	char *s;
+	size_t len, size;  /* in bytes */
+};
+
+static void* abnf_bin_table_add(struct abnf_bin_table *t, size_t len) {
+	char *p;
+	size_t size;
+	if (t->len + len > t->size) {
+		for (size = t->size?t->size*2:4096; size < t->len + len; size *= 2);
+		p = abnf_realloc(t->s, size);
+		if (!p) return NULL;
+		t->s = p;
+		t->size = size;
+	}
+	p = t->s + t->len;
+	memset(p, 0, len);
+	t->len += len;
+	return p;
+}
+
+struct abnf_bin_image {
+	struct abnf_bin_table rules, alternations, concatenations, index, strings;
+	struct abnf_str last_origin;
+	uint32_t last_origin_ofs;
+	int err;
+};
+
+#define ABNF_BIN_COUNT(_t_, _type_) ((uint32_t) ((_t_).len / sizeof(_type_)))
+
+static uint32_t abnf_bin_add_str(struct abnf_bin_image *img, struct abnf_str s) {
+	char *p;
+	uint32_t ofs;
+	ofs = img->strings.len;
+	if (s.len) {
+		p = abnf_bin_table_add(&img->strings, s.len);
+		if (!p) {
+			img->err = 1;
+			return 0;
+		}
+		memcpy(p, s.s, s.len);
+	}
+	return ofs;
+}
+
+/* nodes are numbered in pre order, i.e. nested and next nodes have higher index */
+static uint32_t abnf_bin_add_alternations(struct abnf_bin_image *img, struct abnf_alternation *pa) {
+	struct abnf_concatenation *pc;
+	struct abnf_bin_alternation *ba;
+	struct abnf_bin_concatenation *bc;
+	uint32_t first, ia, ic, g;
+
+	first = ABNF_BIN_COUNT(img->alternations, *ba) + 1;
+	for (; pa && !img->err; pa = pa->next) {
+		ia = ABNF_BIN_COUNT(img->alternations, *ba);
+		if (!abnf_bin_table_add(&img->alternations, sizeof(*ba))) {
+			img->err = 1;
+			break;
+		}
+		if (pa->concatenation)
+			((struct abnf_bin_alternation *) img->alternations.s)[ia].concatenation = ABNF_BIN_COUNT(img->concatenations, *bc) + 1;
+		for (pc = pa->concatenation; pc && !img->err; pc = pc->next) {
+			ic = ABNF_BIN_COUNT(img->concatenations, *bc);
+			if (!abnf_bin_table_add(&img->concatenations, sizeof(*bc))) {
+				img->err = 1;
+				break;
+			}
+			bc = (struct abnf_bin_concatenation *) img->concatenations.s + ic;
+			bc->min = pc->repetition.min;
+			bc->max = pc->repetition.max;
+			bc->type = pc->repetition.element.type;
+			switch (pc->repetition.element.type) {
+				case ABNF_ET_RULE:
+					bc->b = pc->repetition.element.u.rule.name.len;
+					bc->a = abnf_bin_add_str(img, pc->repetition.element.u.rule.name);
+					break;
+				case ABNF_ET_STRING:
+				case ABNF_ET_TOKEN:
+					bc->b = pc->repetition.element.u.string.len;
+					bc->a = abnf_bin_add_str(img, pc->repetition.element.u.string);
+					break;
+				case ABNF_ET_RANGE:
+					bc->a = pc->repetition.element.u.range.lo;
+					bc->b = pc->repetition.element.u.range.hi;
+					break;
+				case ABNF_ET_GROUP:
+					g = pc->repetition.element.u.group?abnf_bin_add_alternations(img, pc->repetition.element.u.group):0;
+					/* table might be reallocated */
+					((struct abnf_bin_concatenation *) img->concatenations.s)[ic].a = g;
+					break;
+				default:
+					bc->type = ABNF_ET_NONE;  /* actions cannot be stored */
+					break;
+			}
+			if (pc->next)
+				((struct abnf_bin_concatenation *) img->concatenations.s)[ic].next = ABNF_BIN_COUNT(img->concatenations, *bc) + 1;
+		}
+		if (pa->next)
+			((struct abnf_bin_alternation *) img->alternations.s)[ia].next = ABNF_BIN_COUNT(img->alternations, *ba) + 1;
+	}
+	return first;
+}
+
+int abnf_build_bin_tables(struct abnf_rule *rules, struct abnf_bin_tables *t) {
+	struct abnf_bin_image img;
+	struct abnf_bin_rule *br;
+	struct abnf_rule *pr;
+	uint32_t ir, n, index_size, *buckets, *tails;
+
+	memset(t, 0, sizeof(*t));
+	memset(&img, 0, sizeof(img));
+	for (pr = rules; pr && !img.err; pr = pr->next) {
+		ir = ABNF_BIN_COUNT(img.rules, *br);
+		if (!abnf_bin_table_add(&img.rules, sizeof(*br))) {
+			img.err = 1;
+			break;
+		}
+		br = (struct abnf_bin_rule *) img.rules.s + ir;
+		br->name_len = pr->name.len;
+		br->name = abnf_bin_add_str(&img, pr->name);
+		/* rules coming from the same source share origin */
+		if (img.last_origin.len != pr->origin.len ||
+			(img.last_origin.s != pr->origin.s && memcmp(img.last_origin.s, pr->origin.s, pr->origin.len) != 0)) {
+			img.last_origin = pr->origin;
+			img.last_origin_ofs = abnf_bin_add_str(&img, pr->origin);
+		}
+		br->origin = img.last_origin_ofs;
+		br->origin_len = pr->origin.len;
+		br->flags = pr->internal.flags & ABNF_INTERNAL_INCREMENTAL;
+		if (pr->alternation) {
+			br->alternation = abnf_bin_add_alternations(&img, pr->alternation);
+		}
+	}
+	/* rule name hash, rules of bucket are chained in list order */
+	n = ABNF_BIN_COUNT(img.rules, struct abnf_bin_rule);
+	for (index_size = n?16:0; index_size < n; index_size *= 2);
+	tails = NULL;
+	if (!img.err && index_size) {
+		buckets = abnf_bin_table_add(&img.index, sizeof(*buckets)*index_size);
+		tails = abnf_malloc(sizeof(*tails)*index_size);
+		if (!buckets || !tails) {
+			img.err = 1;
+		}
+		else {
+			memset(tails, 0, sizeof(*tails)*index_size);
+			br = (struct abnf_bin_rule *) img.rules.s;
+			for (pr = rules, ir = 0; pr; pr = pr->next, ir++) {
+				br[ir].hash = abnf_hash_name(pr->name);
+				if (tails[br[ir].hash & (index_size-1)])
+					br[tails[br[ir].hash & (index_size-1)]-1].hash_next = ir+1;
+				else
+					buckets[br[ir].hash & (index_size-1)] = ir+1;
+				tails[br[ir].hash & (index_size-1)] = ir+1;
+			}
+		}
+		if (tails) abnf_free(tails);
+	}
+	t->rules = (struct abnf_bin_rule *) img.rules.s;
+	t->alternations = (struct abnf_bin_alternation *) img.alternations.s;
+	t->concatenations = (struct abnf_bin_concatenation *) img.concatenations.s;
+	t->index = (uint32_t *) img.index.s;
+	t->strings = img.strings.s;
+	t->rule_count = ABNF_BIN_COUNT(img.rules, struct abnf_bin_rule);
+	t->alternation_count = ABNF_BIN_COUNT(img.alternations, struct abnf_bin_alternation);
+	t->concatenation_count = ABNF_BIN_COUNT(img.concatenations, struct abnf_bin_concatenation);
+	t->index_size = index_size;
+	t->string_size = img.strings.len;
+	if (img.err) {
+		/* caller reports error */
+		abnf_free_bin_tables(t);
+		return -1;
+	}
+	return 0;
+}
+
+void abnf_free_bin_tables(struct abnf_bin_tables *t) {
+	if (t->rules) abnf_free((void *) t->rules);
+	if (t->alternations) abnf_free((void *) t->alternations);
+	if (t->concatenations) abnf_free((void *) t->concatenations);
+	if (t->index) abnf_free((void *) t->index);
+	if (t->strings) abnf_free((void *) t->strings);
+	memset(t, 0, sizeof(*t));
+}
+
+int abnf_print_bin_rules(FILE *stream, struct abnf_rule *rules, struct abnf_print_info *info) {
+	struct abnf_bin_tables t;
+	struct abnf_bin_header hdr;
+	int ret = 0;
+
+	if (abnf_build_bin_tables(rules, &t) < 0)
+		return -1;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, ABNF_BIN_MAGIC, sizeof(hdr.magic));
+	hdr.format = ABNF_BIN_FORMAT;
+	hdr.bom = ABNF_BIN_BOM;
+	strncpy(hdr.version, VERSION_S, sizeof(hdr.version)-1);
+	hdr.rule_count = t.rule_count;
+	hdr.alternation_count = t.alternation_count;
+	hdr.concatenation_count = t.concatenation_count;
+	hdr.index_size = t.index_size;
+	hdr.string_size = t.string_size;
+	if (fwrite(&hdr, sizeof(hdr), 1, stream) != 1 ||
+		(t.rule_count && fwrite(t.rules, sizeof(*t.rules), t.rule_count, stream) != t.rule_count) ||
+		(t.alternation_count && fwrite(t.alternations, sizeof(*t.alternations), t.alternation_count, stream) != t.alternation_count) ||
+		(t.concatenation_count && fwrite(t.concatenations, sizeof(*t.concatenations), t.concatenation_count, stream) != t.concatenation_count) ||
+		(t.index_size && fwrite(t.index, sizeof(*t.index), t.index_size, stream) != t.index_size) ||
+		(t.string_size && fwrite(t.strings, t.string_size, 1, stream) != 1)) {
+		ret = -1;
+	}
+	abnf_free_bin_tables(&t);
+	return ret;
+}
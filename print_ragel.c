@@ -28,8 +28,10 @@
 		(_c_)=='\0' || (_c_)=='\a' || (_c_)=='\b' || (_c_)=='\t' || \
 		(_c_)=='\n' || (_c_)=='\v' || (_c_)=='\f' || (_c_)=='\r' )
 
-static char* abnf_escape_char(char c) {
-	static char buff[5];
+#define ABNF_ESCAPE_CHAR_SIZE 5
+
+/* returns constant or buff which must have ABNF_ESCAPE_CHAR_SIZE chars */
+static char* abnf_escape_char(char c, char *buff) {
 	if (ABNF_IS_VALID_OR_ESCAPABLE_CHAR(c)) {
 		switch (c) {
 			case '\0':
@@ -59,24 +61,20 @@ static char* abnf_escape_char(char c) {
 		}
 	}
 	else {
-		snprintf(buff, sizeof(buff)-1, "%%x%.2x", (unsigned char) c);
+		snprintf(buff, ABNF_ESCAPE_CHAR_SIZE, "%%x%.2x", (unsigned char) c);
 	}
 	return buff;
 }
 
-static char* abnf_get_ragel_rule_name(struct abnf_str s, struct abnf_rule *rules) {
-	static char buff[100];
-	struct abnf_rule *pr;
+#define ABNF_RAGEL_RULE_NAME_SIZE 100
+
+/* buff must have ABNF_RAGEL_RULE_NAME_SIZE chars */
+static char* abnf_get_ragel_rule_name(struct abnf_str s, char *buff) {
 	unsigned int i;
-	char *reserved[] = {"any", "ascii", "extend", "alpha", "digit", "alnum", "lower", "upper",
+	static const char *reserved[] = {"any", "ascii", "extend", "alpha", "digit", "alnum", "lower", "upper",
 					"xdigit", "cntrl", "graph", "print", "punct", "space", "null", "empty", NULL};
-	/* get name as declared, name is case sensitive in ragel but unsensitive in abnf */
-	if (rules) {
-		pr = abnf_find_rule(rules, s);
-		if (pr) s = pr->name;
-	}
 	/* make copy */
-	if (s.len > sizeof(buff)-1) s.len = sizeof(buff)-1;
+	if (s.len > ABNF_RAGEL_RULE_NAME_SIZE-1) s.len = ABNF_RAGEL_RULE_NAME_SIZE-1;
 	memcpy(buff, s.s, s.len);
 	buff[s.len] = '\0';
 	/* change '-' to '_' */
@@ -94,43 +92,45 @@ static char* abnf_get_ragel_rule_name(struct abnf_str s, struct abnf_rule *rules
 	return buff;
 }
 
-static void abnf_print_ragel_element(FILE *stream, struct abnf_rule *pr, struct abnf_element *e);
-static void abnf_print_ragel_alternations(FILE *stream, struct abnf_rule *pr, struct abnf_alternation *pa) {
+static void abnf_print_ragel_element(struct abnf_writer *w, struct abnf_rule *pr, struct abnf_element *e);
+static void abnf_print_ragel_alternations(struct abnf_writer *w, struct abnf_rule *pr, struct abnf_alternation *pa) {
 	struct abnf_concatenation *pc;
 	int ia, na, ic, nc;
 	na = abnf_alternation_count(pa);
 	for (ia = 0; pa; pa = pa->next, ia++) {
-		if (ia > 0) fprintf(stream, " | ");
+		if (ia > 0) abnf_write(w, " | ", 3);
 		nc = abnf_concatenation_count(pa->concatenation);
-		if (na > 1 && nc > 1) fprintf(stream, "( ");
+		if (na > 1 && nc > 1) abnf_write(w, "( ", 2);
 		for (ic = 0, pc = pa->concatenation; pc; ic++, pc = pc->next) {
-			if (ic > 0) fprintf(stream, " "); /* or '.' */
-			abnf_print_ragel_element(stream, pr, &pc->repetition.element);
+			if (ic > 0) abnf_write_char(w, ' '); /* or '.' */
+			abnf_print_ragel_element(w, pr, &pc->repetition.element);
 			if (ABNF_IS_OPTIONAL(pc->repetition))
-				fprintf(stream, "?");
+				abnf_write_char(w, '?');
 			else if (ABNF_IS_ANY(pc->repetition))
-				fprintf(stream, "*");
+				abnf_write_char(w, '*');
 			else if (ABNF_IS_MORE(pc->repetition))
-				fprintf(stream, "+");
+				abnf_write_char(w, '+');
 			else if (!ABNF_IS_ONCE(pc->repetition)) {
-				fprintf(stream, "{");
-				if (pc->repetition.min > 0) fprintf(stream, "%u", pc->repetition.min);
+				abnf_write_char(w, '{');
+				if (pc->repetition.min > 0) abnf_write_uint(w, pc->repetition.min);
 				if (pc->repetition.min != pc->repetition.max) {
-					fprintf(stream, ",");
-					if (pc->repetition.max != ABNF_INFINITY) fprintf(stream, "%u", pc->repetition.max);
+					abnf_write_char(w, ',');
+					if (pc->repetition.max != ABNF_INFINITY) abnf_write_uint(w, pc->repetition.max);
 				}
-				fprintf(stream, "}");
+				abnf_write_char(w, '}');
 			}
 		}
-		if (na > 1 && nc > 1) fprintf(stream, " )");
+		if (na > 1 && nc > 1) abnf_write(w, " )", 2);
 	}
 }
 
-static void abnf_print_ragel_element(FILE *stream, struct abnf_rule *pr, struct abnf_element *e) {
+static void abnf_print_ragel_element(struct abnf_writer *w, struct abnf_rule *pr, struct abnf_element *e) {
 	int i, j, n, na, nc;
+	char name_buff[ABNF_RAGEL_RULE_NAME_SIZE], esc_buff[ABNF_ESCAPE_CHAR_SIZE];
 	switch (e->type) {
 		case ABNF_ET_RULE:
-			fprintf(stream, "%s", abnf_get_ragel_rule_name(e->u.rule.name, pr));
+			/* get name as declared, name is case sensitive in ragel but unsensitive in abnf */
+			abnf_write_cstr(w, abnf_get_ragel_rule_name(e->u.rule.resolved?e->u.rule.resolved->name:e->u.rule.name, name_buff));
 			break;
 		case ABNF_ET_GROUP:
 			na = abnf_alternation_count(e->u.group);
@@ -138,30 +138,38 @@ static void abnf_print_ragel_element(FILE *stream, struct abnf_rule *pr, struct
 				nc = abnf_concatenation_count(e->u.group->concatenation);
 			else
 				nc = 0;
-			if (na > 1 || (na == 1 && nc > 1)) fprintf(stream, "( "); /* abnf_print_ragel_alternation won't add parenthesis */
-				abnf_print_ragel_alternations(stream, pr, e->u.group);
-			if (na > 1 || (na == 1 && nc > 1)) fprintf(stream, " )"); /* abnf_print_ragel_alternation won't add parenthesis */
+			if (na > 1 || (na == 1 && nc > 1)) abnf_write(w, "( ", 2); /* abnf_print_ragel_alternation won't add parenthesis */
+				abnf_print_ragel_alternations(w, pr, e->u.group);
+			if (na > 1 || (na == 1 && nc > 1)) abnf_write(w, " )", 2); /* abnf_print_ragel_alternation won't add parenthesis */
 			break;
 		case ABNF_ET_RANGE:
 			if (e->u.range.lo == e->u.range.hi) {
 				if (ABNF_IS_ALPHA(e->u.range.lo) || !ABNF_IS_VALID_OR_ESCAPABLE_CHAR(e->u.range.lo) ) {
-					fprintf(stream, "0x%.2x", e->u.range.lo);
+					abnf_write(w, "0x", 2);
+					abnf_write_hex(w, e->u.range.lo);
+				}
+				else {
+					abnf_write_char(w, '"');
+					abnf_write_cstr(w, abnf_escape_char(e->u.range.lo, esc_buff));
+					abnf_write_char(w, '"');
 				}
-				else
-					fprintf(stream, "\"%s\"", abnf_escape_char(e->u.range.lo));
 			}
 			else {
 				/* if (ABNF_IS_VALID_OR_ESCAPABLE_CHAR(e->u.range.lo) && ABNF_IS_VALID_OR_ESCAPABLE_CHAR(e->u.range.hi)) {
 					fprintf(stream, "\"%c\"..\"%c\"", e->u.range.lo, e->u.range.hi);
 				}
 				else */
-					fprintf(stream, "0x%.2x..0x%.2x", e->u.range.lo, e->u.range.hi);
+					abnf_write(w, "0x", 2);
+					abnf_write_hex(w, e->u.range.lo);
+					abnf_write(w, "..0x", 4);
+					abnf_write_hex(w, e->u.range.hi);
 			}
 			break;
 		case ABNF_ET_STRING:
 			for (i=0; i < e->u.string.len; i++) {
-				if (i > 0) fprintf(stream, ".");
-				fprintf(stream, "0x%.2x", (unsigned char) e->u.string.s[i]);
+				if (i > 0) abnf_write_char(w, '.');
+				abnf_write(w, "0x", 2);
+				abnf_write_hex(w, e->u.string.s[i]);
 			}
 			break;
 		case ABNF_ET_TOKEN:
@@ -173,31 +181,32 @@ static void abnf_print_ragel_element(FILE *stream, struct abnf_rule *pr, struct
 					for (i++; i < e->u.token.len && !ABNF_IS_VALID_TOKEN_CHAR(e->u.token.s[i]); i++);
 				}
 			}
-			if (n > 1) fprintf(stream, "( ");
+			if (n > 1) abnf_write(w, "( ", 2);
 			for (i=0; i < e->u.token.len; ) {
-				if (i > 0) fprintf(stream, " ");
+				if (i > 0) abnf_write_char(w, ' ');
 				j = i;
 				if (ABNF_IS_VALID_OR_ESCAPABLE_CHAR(e->u.token.s[i])) {
 					int alpha_fl = 0;
-					fprintf(stream, "\"");
+					abnf_write_char(w, '"');
 					do {
 						if (ABNF_IS_ALPHA(e->u.token.s[i]))
 							alpha_fl = 1;
-						fprintf(stream, "%s", abnf_escape_char(e->u.token.s[i]));
+						abnf_write_cstr(w, abnf_escape_char(e->u.token.s[i], esc_buff));
 						i++;
 					} while (ABNF_IS_VALID_OR_ESCAPABLE_CHAR(e->u.token.s[i]) && i < e->u.token.len);
-					fprintf(stream, "\"");
+					abnf_write_char(w, '"');
 					if (alpha_fl)
-						fprintf(stream, "i");
+						abnf_write_char(w, 'i');
 				}
 				else {
 					for (i++; i < e->u.token.len && !ABNF_IS_VALID_TOKEN_CHAR(e->u.token.s[i]); i++) {
-						if (i > j) fprintf(stream, ".");
-						fprintf(stream, "0x%.2x", (unsigned char) e->u.token.s[i]);
+						if (i > j) abnf_write_char(w, '.');
+						abnf_write(w, "0x", 2);
+						abnf_write_hex(w, e->u.token.s[i]);
 					}
 				}
 			}
-			if (n > 1) fprintf(stream, " )");
+			if (n > 1) abnf_write(w, " )", 2);
 			break;
 
 		default:
@@ -209,25 +218,38 @@ void abnf_print_ragel_rules(FILE *stream, struct abnf_rule *rules, struct abnf_p
 			    char *machine_name, int instantiate) {
 	struct abnf_rule *pr, *last_pr;
 	struct abnf_print_comment comment_def = {.pre_comment = NULL, .line_comment = "# ", .post_comment = NULL};
+	char name_buff[ABNF_RAGEL_RULE_NAME_SIZE];
+	struct abnf_writer *w;
 
 	abnf_print_header(stream, info, &comment_def);
+	w = abnf_malloc(sizeof(*w));
+	if (!w) {
+		fprintf(stderr, "ERROR: not enough memory for output buffer\n");
+		return;
+	}
+	abnf_writer_init(w, stream);
 
-	fprintf(stream, "%%%%{\n");
-	fprintf(stream, "\t# write your name\n\tmachine %s;\n\n\t# generated rules, define required actions\n", machine_name);
+	abnf_writef(w, "%%%%{\n");
+	abnf_writef(w, "\t# write your name\n\tmachine %s;\n\n\t# generated rules, define required actions\n", machine_name);
 	last_pr = NULL;
 	for (pr = rules; pr; pr = pr->next) {
-		fprintf(stream, "\t%s = ", abnf_get_ragel_rule_name(pr->name, NULL));
-		abnf_print_ragel_alternations(stream, pr, pr->alternation);
-		fprintf(stream, ";\n");
+		abnf_write_char(w, '\t');
+		abnf_write_cstr(w, abnf_get_ragel_rule_name(pr->name, name_buff));
+		abnf_write(w, " = ", 3);
+		abnf_print_ragel_alternations(w, pr, pr->alternation);
+		abnf_write(w, ";\n", 2);
 		last_pr = pr;
 	}
 	if (instantiate) {
-	  fprintf(stream, "\n\t# instantiate machine rules\n");
+	  if (info && info->main_rule.len && (pr = abnf_find_rule(rules, info->main_rule)))
+	    last_pr = pr;
+	  abnf_writef(w, "\n\t# instantiate machine rules\n");
 	  if (last_pr)
-	    fprintf(stream, "\tmain:= %s;\n", abnf_get_ragel_rule_name(last_pr->name, NULL));
+	    abnf_writef(w, "\tmain:= %s;\n", abnf_get_ragel_rule_name(last_pr->name, name_buff));
 	  else
-	    fprintf(stream, "\t# main:= <rule_name>;\n");
+	    abnf_writef(w, "\t# main:= <rule_name>;\n");
 	}
-	fprintf(stream, "}%%%%\n");
+	abnf_writef(w, "}%%%%\n");
+	abnf_writer_flush(w);
+	abnf_free(w);
 }
-
@@ -21,216 +21,169 @@
 
 #include "abnf.h"
 
-/* export to self structures of abnfc
+/* export to self structures of abnfc, rule list is written as static tables
+ * linked by index (see struct abnf_bin_tables) so declaring them costs no parsing
+ * and no per node construction, loader only fixes up pointers
  */
-inline static void abnf_print_rep_char(FILE *stream, char c, int n) {
-	for (; n > 0; n--) {
-		fprintf(stream, "%c", c);
-	}
-}
-
-inline static void findent(FILE *stream, int indent) {
-	for (; indent>0; indent--) fprintf(stream, "\t");
+static char *abnf_self_type_names[] = {
+	[ABNF_ET_NONE] = "ABNF_ET_NONE",
+	[ABNF_ET_RULE] = "ABNF_ET_RULE",
+	[ABNF_ET_GROUP] = "ABNF_ET_GROUP",
+	[ABNF_ET_STRING] = "ABNF_ET_STRING",
+	[ABNF_ET_TOKEN] = "ABNF_ET_TOKEN",
+	[ABNF_ET_RANGE] = "ABNF_ET_RANGE",
+	[ABNF_ET_ACTION] = "ABNF_ET_ACTION",
+};
+
+static void abnf_print_self_count(struct abnf_writer *w, uint32_t n) {
+	if (n == ABNF_INFINITY)
+		abnf_write_cstr(w, "ABNF_INFINITY");
+	else
+		abnf_write_uint(w, n);
 }
 
-/* warning two commands if used in blockless place */
-#define findentf findent(stream, indent); fprintf
-
-static void abnf_print_self_element(FILE *stream, struct abnf_element *e, int indent);
-static void abnf_print_self_alternations(FILE *stream, struct abnf_alternation *pa, int indent) {
-	struct abnf_concatenation *pc;
-	int ia, ic;
-	if (!pa) {
-		findentf(stream, "NULL");   /* no CRLF */
-	}
-	else {
-		for (ia = 0; pa; pa = pa->next, ia++) {
-			findentf(stream, "abnf_add_alternation(\n");
-			indent++;
-			if (!pa->concatenation) {
-				findentf(stream, "NULL,\n");
-			}
-			else {
-				for (ic = 0, pc = pa->concatenation; pc; ic++, pc = pc->next) {
-					int fl = 0;
-					findentf(stream, "abnf_add_concatenation(\n");
-					indent++;
-					if (ABNF_IS_OPTIONAL(pc->repetition)) {
-						findentf(stream, "abnf_mk_optional(\n");
-					} else if (ABNF_IS_ONCE(pc->repetition)) {
-						findentf(stream, "abnf_mk_once(\n");
-					} else if (ABNF_IS_ANY(pc->repetition)) {
-						findentf(stream, "abnf_mk_any(\n");
-					} else if (ABNF_IS_MORE(pc->repetition)) {
-						findentf(stream, "abnf_mk_more(\n");
-					} else {
-						fl = 1;
-						findentf(stream, "abnf_mk_repetition(\n");
-					}
-					indent++;
-					abnf_print_self_element(stream, &pc->repetition.element, indent);
-
-					if (fl) {
-						findentf(stream, ", ");
-						if (pc->repetition.min == ABNF_INFINITY)
-							fprintf(stream, "ABNF_INFINITY, ");
-						else
-							fprintf(stream, "%d, ", pc->repetition.min);
-						if (pc->repetition.max == ABNF_INFINITY)
-							fprintf(stream, "ABNF_INFINITY\n");
-						else
-							fprintf(stream, "%d\n", pc->repetition.max);
-					}
-					indent--;
-					findentf(stream, "),\n");
-					indent--;
-				}
-				indent++;
-				findentf(stream, "NULL  /* end of concatenations */\n");
-				indent--;
-				findent(stream, indent);
-				for (; ic > 0; ic--) fprintf(stream, ")");  /* no CRLF */
-				fprintf(stream, ",\n");
-    		}
-			indent--;
+/* octal escapes because hex escape would swallow following hex digit */
+static void abnf_print_self_chars(struct abnf_writer *w, const char *s, uint32_t len) {
+	uint32_t i;
+	unsigned char c;
+	abnf_write_char(w, '"');
+	for (i=0; i<len; i++) {
+		c = s[i];
+		switch (c) {
+			case '\r': abnf_write(w, "\\r", 2); break;
+			case '\n': abnf_write(w, "\\n", 2); break;
+			case '\t': abnf_write(w, "\\t", 2); break;
+			case '\"': abnf_write(w, "\\\"", 2); break;
+			case '\\': abnf_write(w, "\\\\", 2); break;
+			case '?': abnf_write(w, "\\?", 2); break;  /* trigraphs */
+			default:
+				if (c >= ' ' && c <= 0x7e)
+					abnf_write_char(w, c);
+				else
+					abnf_writef(w, "\\%.3o", c);
+				break;
 		}
-		indent++;
-		findentf(stream, "NULL  /* end of alternations */\n");
-		indent--;
-		findent(stream, indent);
-		for (; ia > 0; ia--) fprintf(stream, ")");
-		/* no CRLF */
 	}
+	abnf_write_char(w, '"');
 }
 
-static void print_char(FILE *stream, unsigned char c) {
-	switch (c) {
-		case '\r': fprintf(stream, "'\\r'"); return;
-		case '\n': fprintf(stream, "'\\n'"); return;
-		case '\t': fprintf(stream, "'\\t'"); return;
-		case '\'': fprintf(stream, "'\\'"); return;
-		default:
-		;
-	}
-	if (c >= ' ' && c <= 0x7e)
-		fprintf(stream, "'%c'", c);
-	else
-		fprintf(stream, "0x%.2x", c);
-}
-
-static void print_string(FILE *stream, struct abnf_str s) {
-	int i;
-	if (s.len == 0) {
-		fprintf(stream, "NULL");
-	}
-	else {
-		fprintf(stream, "\"");
-		for (i=0; i<s.len; i++) {
-			if (s.s[i] >= ' ' && s.s[i] <= 0x7E) {
-				fprintf(stream, "%c", s.s[i]);
-			}
-			else {
-				switch (s.s[i]) {
-					case '\r': fprintf(stream, "\\r"); break;
-					case '\n': fprintf(stream, "\\n"); break;
-					case '\t': fprintf(stream, "\\t"); break;
-					case '\"': fprintf(stream, "\\\""); break;
-					case '\0': fprintf(stream, "\\0"); break;
-					default:
-						fprintf(stream, "\\%.2x", (unsigned char) s.s[i]);
-						break;
-				}
+static void abnf_print_self_strings(struct abnf_writer *w, struct abnf_bin_tables *t, char *name) {
+	unsigned char *starts;
+	uint32_t i, j;
+	if (!t->string_size) return;
+	/* each string on its own line */
+	starts = abnf_malloc(t->string_size);
+	if (starts) {
+		memset(starts, 0, t->string_size);
+		for (i=0; i<t->rule_count; i++) {
+			if (t->rules[i].name_len) starts[t->rules[i].name] = 1;
+			if (t->rules[i].origin_len) starts[t->rules[i].origin] = 1;
+		}
+		for (i=0; i<t->concatenation_count; i++) {
+			switch (t->concatenations[i].type) {
+				case ABNF_ET_RULE:
+				case ABNF_ET_STRING:
+				case ABNF_ET_TOKEN:
+					if (t->concatenations[i].b) starts[t->concatenations[i].a] = 1;
+					break;
+				default:
+					break;
 			}
 		}
-		fprintf(stream, "\"");
 	}
-}
-
-static void abnf_print_self_element(FILE *stream, struct abnf_element *e, int indent) {
-	switch (e->type) {
-		case ABNF_ET_RULE:
-			findentf(stream, "abnf_mk_element_rule(abnf_mk_str(");
-			print_string(stream, e->u.rule.name);
-			fprintf(stream, "))\n");
-			break;
-		case ABNF_ET_GROUP:
-			findentf(stream, "abnf_mk_element_group(\n");
-			abnf_print_self_alternations(stream, e->u.group, indent+1);
-			fprintf(stream, "\n");
-			findentf(stream, ")\n");
-			break;
-		case ABNF_ET_RANGE:
-			if (e->u.range.lo == e->u.range.hi) {
-				findentf(stream, "abnf_mk_element_char(");
-			}
-			else {
-				findentf(stream, "abnf_mk_element_range(");
-				print_char(stream, e->u.range.lo);
-				fprintf(stream, ", ");
-			}
-			print_char(stream, e->u.range.hi);
-			fprintf(stream, ")\n");
-			break;
-		case ABNF_ET_STRING:
-			findentf(stream, "abnf_mk_element_string(abnf_mk_str(");
-			print_string(stream, e->u.string);
-			fprintf(stream, "))\n");
-			break;
-		case ABNF_ET_TOKEN:
-			findentf(stream, "abnf_mk_element_token(abnf_mk_str(");
-			print_string(stream, e->u.string);
-			fprintf(stream, "))\n");
-			break;
-
-		default:
-			findentf(stream, "abnf_mk_element_empty()\n");
-			break;
+	abnf_writef(w, "static const char %s_strings[] =\n", name);
+	for (i=0; i<t->string_size; i=j) {
+		for (j=i+1; j<t->string_size && (starts?!starts[j]:j-i<64); j++);
+		abnf_write_char(w, '\t');
+		abnf_print_self_chars(w, t->strings+i, j-i);
+		abnf_writef(w, "  /* %u */\n", i);
 	}
+	abnf_writef(w, "\t;\n\n");
+	if (starts) abnf_free(starts);
 }
 
-void abnf_print_self_rules(FILE *stream, struct abnf_rule *rules, struct abnf_print_info *info) {
-	int ir, indent;
-	struct abnf_rule *pr;
+int abnf_print_self_rules(FILE *stream, struct abnf_rule *rules, struct abnf_print_info *info, char *name) {
+	struct abnf_bin_tables t;
 	struct abnf_print_comment comment_def = {.pre_comment = "/*\n", .line_comment = " * ", .post_comment = " */\n"};
-
+	struct abnf_writer *w;
+	uint32_t i;
+	int ret;
+
+	if (abnf_build_bin_tables(rules, &t) < 0)
+		return -1;
+	w = abnf_malloc(sizeof(*w));
+	if (!w) {
+		abnf_free_bin_tables(&t);
+		return -1;
+	}
 	abnf_print_header(stream, info, &comment_def);
-
-	indent = 0;
-	findentf(stream, "#include \"abnf.h\"\n");
-	findentf(stream, "struct abnf_rule* abnf_declare_custom_rules(struct abnf_rule* next) {\n");
-	fprintf(stream, "\n");
-	indent++;
-	findentf(stream, "struct abnf_rule *rule_list;\n");
-	fprintf(stream, "\n");
-
-	findentf(stream, "rule_list = \n");
-	indent++;
-	if (!rules) {
-		findentf(stream, "NULL;\n");
+	abnf_writer_init(w, stream);
+
+	abnf_writef(w, "#include \"abnf.h\"\n\n");
+	if (t.rule_count) {
+		abnf_writef(w, "static const struct abnf_bin_rule %s_rules[] = {\n", name);
+		abnf_writef(w, "\t/* name, name_len, origin, origin_len, alternation, flags, hash, hash_next */\n");
+		for (i=0; i<t.rule_count; i++) {
+			abnf_writef(w, "\t{%u, %u, %u, %u, %u, %u, 0x%.8x, %u},  /* %u: %.*s */\n",
+				t.rules[i].name, t.rules[i].name_len, t.rules[i].origin, t.rules[i].origin_len,
+				t.rules[i].alternation, t.rules[i].flags, t.rules[i].hash, t.rules[i].hash_next,
+				i+1, (int) t.rules[i].name_len, t.strings+t.rules[i].name);
+		}
+		abnf_writef(w, "};\n\n");
 	}
-	else {
-
-		for (pr = rules, ir = 0; pr; pr = pr->next, ir++) {
-			findentf(stream, "abnf_add_rule(\n");
-			indent++;
-			findentf(stream, "abnf_mk_str(\"%.*s\"),\n", pr->name.len, pr->name.s);
-			abnf_print_self_alternations(stream, pr->alternation, 3);
-			fprintf(stream, ",\n");
-			indent--;
+	if (t.alternation_count) {
+		abnf_writef(w, "static const struct abnf_bin_alternation %s_alternations[] = {\n", name);
+		abnf_writef(w, "\t/* concatenation, next */\n");
+		for (i=0; i<t.alternation_count; i++) {
+			abnf_writef(w, "\t{%u, %u},  /* %u */\n",
+				t.alternations[i].concatenation, t.alternations[i].next, i+1);
+		}
+		abnf_writef(w, "};\n\n");
+	}
+	if (t.concatenation_count) {
+		abnf_writef(w, "static const struct abnf_bin_concatenation %s_concatenations[] = {\n", name);
+		abnf_writef(w, "\t/* min, max, type, a, b, next */\n");
+		for (i=0; i<t.concatenation_count; i++) {
+			abnf_write(w, "\t{", 2);
+			abnf_print_self_count(w, t.concatenations[i].min);
+			abnf_write(w, ", ", 2);
+			abnf_print_self_count(w, t.concatenations[i].max);
+			abnf_writef(w, ", %s, ", t.concatenations[i].type <= ABNF_ET_ACTION ? abnf_self_type_names[t.concatenations[i].type] : "ABNF_ET_NONE");
+			if (t.concatenations[i].type == ABNF_ET_RANGE)
+				abnf_writef(w, "0x%.2x, 0x%.2x", t.concatenations[i].a, t.concatenations[i].b);
+			else
+				abnf_writef(w, "%u, %u", t.concatenations[i].a, t.concatenations[i].b);
+			abnf_writef(w, ", %u},  /* %u */\n", t.concatenations[i].next, i+1);
+		}
+		abnf_writef(w, "};\n\n");
+	}
+	if (t.index_size) {
+		abnf_writef(w, "static const uint32_t %s_index[] = {", name);
+		for (i=0; i<t.index_size; i++) {
+			abnf_writef(w, "%s%u,", i % 16 ? " " : "\n\t", t.index[i]);
 		}
-		indent++;
-		fprintf(stream, "\n");
-		findentf(stream, "next  /* end of rules */\n");
-		indent--;
-		findent(stream, indent);
-		for (; ir > 0; ir--) fprintf(stream, ")");
-		fprintf(stream, ";\n");
+		abnf_writef(w, "\n};\n\n");
 	}
-	indent--;
-	fprintf(stream, "\n");
-	findentf(stream, "/* abnf_rule_assign_origin(rule_list, next, abnf_mk_str(\"custom\")); */\n");
-	fprintf(stream, "\n");
-	findentf(stream, "return rule_list;\n");
-	indent--;
-	findentf(stream, "}\n");
+	abnf_print_self_strings(w, &t, name);
+
+	abnf_writef(w, "static const struct abnf_bin_tables %s_tables = {\n", name);
+	abnf_writef(w, "\t.rules = %s%s,\n", t.rule_count ? name : "NULL", t.rule_count ? "_rules" : "");
+	abnf_writef(w, "\t.alternations = %s%s,\n", t.alternation_count ? name : "NULL", t.alternation_count ? "_alternations" : "");
+	abnf_writef(w, "\t.concatenations = %s%s,\n", t.concatenation_count ? name : "NULL", t.concatenation_count ? "_concatenations" : "");
+	abnf_writef(w, "\t.index = %s%s,\n", t.index_size ? name : "NULL", t.index_size ? "_index" : "");
+	abnf_writef(w, "\t.strings = %s%s,\n", t.string_size ? name : "NULL", t.string_size ? "_strings" : "");
+	abnf_writef(w, "\t.rule_count = %u,\n", t.rule_count);
+	abnf_writef(w, "\t.alternation_count = %u,\n", t.alternation_count);
+	abnf_writef(w, "\t.concatenation_count = %u,\n", t.concatenation_count);
+	abnf_writef(w, "\t.index_size = %u,\n", t.index_size);
+	abnf_writef(w, "\t.string_size = %u,\n", t.string_size);
+	abnf_writef(w, "};\n\n");
+
+	abnf_writef(w, "int abnf_declare_%s_rules(struct abnf_grammar *g) {\n", name);
+	abnf_writef(w, "\treturn abnf_load_bin_tables(g, &%s_tables, abnf_mk_str(NULL), 1);\n", name);
+	abnf_writef(w, "}\n");
+	ret = abnf_writer_flush(w);
+	abnf_free(w);
+	abnf_free_bin_tables(&t);
+	return ret;
 }
@@ -0,0 +1,65 @@
+#!/bin/sh
+# rules read from stdin in chunks must equal rules read from mapped file,
+# input is longer than one 64 KiB chunk so tokens span chunk boundaries,
+# small grammar is split at each of its offsets and read without final LF
+# usage: stream.sh [abnfc]
+
+ABNFC=${1:-./abnfc}
+TMP=${TMPDIR:-/tmp}/abnfc-stream.$$
+trap 'rm -f $TMP.*' EXIT
+
+set -e
+"$ABNFC" core abnf -f abnf -R -o $TMP.one
+: > $TMP.abnf
+i=0
+while [ $(wc -c < $TMP.abnf) -le 200000 ]; do
+	# odd comment length shifts rules against chunk boundaries
+	echo "; copy $i$(printf '%*s' $((i % 7)) '')" >> $TMP.abnf
+	cat $TMP.one >> $TMP.abnf
+	i=$((i+1))
+done
+
+# sources comment names input file
+"$ABNFC" -t file $TMP.abnf -f abnf -R 2>/dev/null | sed '/^;/d' > $TMP.mapped
+# redirected regular file is mapped too, pipe is read in chunks
+"$ABNFC" -t file - -f abnf -R < $TMP.abnf 2>/dev/null | sed '/^;/d' > $TMP.streamed
+cat $TMP.abnf | "$ABNFC" -t file - -f abnf -R 2>/dev/null | sed '/^;/d' > $TMP.piped
+if [ ! -s $TMP.mapped ]; then
+	echo "stream: no rules parsed from $TMP.abnf"
+	exit 1
+fi
+cmp $TMP.mapped $TMP.streamed
+cmp $TMP.mapped $TMP.piped
+
+cat > $TMP.small <<'EOF'
+rule-1 = "a" / %s"Bc" / %x41-5A / %d13.10 / %b1010
+rule-1 =/ *2( rule-2 [ "x" ] ) 1*rule-3 ; comment
+	<prose value> 3"y"
+rule-2 = rule-3
+rule-3 = %x30.31.32
+EOF
+"$ABNFC" -t file $TMP.small -f abnf -R 2>/dev/null | sed '/^;/d' > $TMP.ref
+if [ ! -s $TMP.ref ]; then
+	echo "stream: no rules parsed from $TMP.small"
+	exit 1
+fi
+# first chunk ends after k bytes of small grammar
+size=$(wc -c < $TMP.small)
+k=0
+while [ $k -le $size ]; do
+	{ printf ';%*s\n' $((65536-k-2)) ''; cat $TMP.small; } > $TMP.split
+	cat $TMP.split | "$ABNFC" -t file - -f abnf -R 2>/dev/null | sed '/^;/d' > $TMP.piped
+	if ! cmp -s $TMP.ref $TMP.piped; then
+		echo "stream: split at offset $k differs"
+		exit 1
+	fi
+	k=$((k+1))
+done
+
+# final rule without LF
+printf '%s' "$(cat $TMP.small)" > $TMP.nolf
+"$ABNFC" -t file $TMP.nolf -f abnf -R 2>/dev/null | sed '/^;/d' > $TMP.mapped
+cat $TMP.nolf | "$ABNFC" -t file - -f abnf -R 2>/dev/null | sed '/^;/d' > $TMP.piped
+cmp $TMP.ref $TMP.mapped
+cmp $TMP.ref $TMP.piped
+echo "stream: ok"